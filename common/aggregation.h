@@ -0,0 +1,137 @@
+#ifndef COMMON_AGGREGATION_H
+#define COMMON_AGGREGATION_H
+
+#include "csr_matrix.h"
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// Coarsening by smoothed aggregation: the matrix graph is split into
+// aggregates of strongly coupled unknowns, the piecewise-constant
+// tentative prolongation is smoothed with one damped Jacobi step and the
+// coarse matrix is the Galerkin product P^T A P. Used by the AMG setup
+// (amg.h) and by Multigrid to coarsen a geometric hierarchy whose coarsest
+// level is too large for a direct solve.
+//
+//   std::vector<CSRMatrix> mats(1, A), prolongations;
+//   sa_coarsen(0.08, 4.0 / 3.0, 300, 25, mats, prolongations);
+
+/// Greedy aggregation on the strong-connection graph of A.
+/// agg[i] is the aggregate of unknown i; returns the number of aggregates.
+inline unsigned sa_aggregate(const CSRMatrix &A, double theta, std::vector<int> &agg)
+{
+    unsigned n = A.n;
+    std::vector<double> diag(n, 0.0);
+    for(unsigned i = 0; i < n; i++)
+        for(unsigned l = A.rowStart[i]; l < A.rowStart[i + 1]; l++)
+            if(A.col[l] == i)
+                diag[i] = A.val[l];
+    auto strong = [&](unsigned i, unsigned l){
+        unsigned j = A.col[l];
+        return j != i && fabs(A.val[l]) >= theta * sqrt(fabs(diag[i] * diag[j]));
+    };
+
+    agg.assign(n, -1);
+    int numAgg = 0;
+    // 1. Roots whose strong neighbourhood is still free take all of it
+    for(unsigned i = 0; i < n; i++){
+        if(agg[i] >= 0)
+            continue;
+        bool free = true;
+        for(unsigned l = A.rowStart[i]; l < A.rowStart[i + 1] && free; l++)
+            if(strong(i, l) && agg[A.col[l]] >= 0)
+                free = false;
+        if(!free)
+            continue;
+        agg[i] = numAgg;
+        for(unsigned l = A.rowStart[i]; l < A.rowStart[i + 1]; l++)
+            if(strong(i, l))
+                agg[A.col[l]] = numAgg;
+        numAgg++;
+    }
+    // 2. Remaining unknowns join the aggregate of a strong neighbour from step 1
+    std::vector<int> first(agg);
+    for(unsigned i = 0; i < n; i++){
+        if(agg[i] >= 0)
+            continue;
+        for(unsigned l = A.rowStart[i]; l < A.rowStart[i + 1]; l++){
+            if(strong(i, l) && first[A.col[l]] >= 0){
+                agg[i] = first[A.col[l]];
+                break;
+            }
+        }
+    }
+    // 3. What is left forms new aggregates with its free strong neighbours
+    for(unsigned i = 0; i < n; i++){
+        if(agg[i] >= 0)
+            continue;
+        agg[i] = numAgg;
+        for(unsigned l = A.rowStart[i]; l < A.rowStart[i + 1]; l++)
+            if(strong(i, l) && agg[A.col[l]] < 0)
+                agg[A.col[l]] = numAgg;
+        numAgg++;
+    }
+    return static_cast<unsigned>(numAgg);
+}
+
+/// Smoothed prolongation P = (I - omega / lmax * D^{-1} A) P_tent,
+/// P_tent(i, agg[i]) = 1; lmax is the Gershgorin bound of D^{-1} A
+inline void sa_prolongation(const CSRMatrix &A, const std::vector<int> &agg, unsigned numAgg, double omega, CSRMatrix &P)
+{
+    unsigned n = A.n;
+    CSRMatrix T;
+    T.n = n;
+    T.rowStart.resize(n + 1);
+    T.col.resize(n);
+    T.val.assign(n, 1.0);
+    for(unsigned i = 0; i <= n; i++)
+        T.rowStart[i] = i;
+    for(unsigned i = 0; i < n; i++)
+        T.col[i] = static_cast<unsigned>(agg[i]);
+
+    std::vector<double> diag(n, 0.0);
+    double lmax = 0.0;
+    for(unsigned i = 0; i < n; i++){
+        double absSum = 0.0;
+        for(unsigned l = A.rowStart[i]; l < A.rowStart[i + 1]; l++){
+            if(A.col[l] == i)
+                diag[i] = A.val[l];
+            absSum += fabs(A.val[l]);
+        }
+        lmax = std::max(lmax, absSum / diag[i]);
+    }
+
+    // A P_tent contains the pattern of P_tent, since the diagonal of A is nonzero
+    csr_matmul(A, T, numAgg, P);
+    for(unsigned i = 0; i < n; i++){
+        double w = omega / (lmax * diag[i]);
+        for(unsigned l = P.rowStart[i]; l < P.rowStart[i + 1]; l++)
+            P.val[l] = (P.col[l] == static_cast<unsigned>(agg[i]) ? 1.0 : 0.0) - w * P.val[l];
+    }
+}
+
+/// Appends Galerkin coarse levels to mats (finest first) until the last one
+/// has at most coarseSize unknowns or mats has maxLevels matrices;
+/// prolongations[l] maps level l+1 to level l. Returns false if the
+/// coarsening stalled above coarseSize.
+inline bool sa_coarsen(double theta, double omega, unsigned coarseSize, unsigned maxLevels,
+                       std::vector<CSRMatrix> &mats, std::vector<CSRMatrix> &prolongations)
+{
+    while(mats.size() < maxLevels && mats.back().n > coarseSize){
+        const CSRMatrix &Af = mats.back();
+        std::vector<int> agg;
+        unsigned numAgg = sa_aggregate(Af, theta, agg);
+        if(numAgg == 0 || numAgg > 0.9 * Af.n)
+            return false;
+        CSRMatrix P, R, AP, Ac;
+        sa_prolongation(Af, agg, numAgg, omega, P);
+        csr_transpose(P, numAgg, R);
+        csr_matmul(Af, P, numAgg, AP);
+        csr_matmul(R, AP, numAgg, Ac);
+        prolongations.push_back(P);
+        mats.push_back(Ac);
+    }
+    return mats.back().n <= coarseSize;
+}
+
+#endif
@@ -0,0 +1,62 @@
+#ifndef COMMON_AMG_H
+#define COMMON_AMG_H
+
+#include "csr_matrix.h"
+#include "aggregation.h"
+#include "multigrid.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+// Smoothed aggregation algebraic multigrid for symmetric positive definite
+// M-matrices such as the TPFA matrix on cells. The setup coarsens the
+// matrix graph into aggregates of strongly coupled unknowns, smooths the
+// piecewise-constant tentative prolongation with one damped Jacobi step
+// and forms Galerkin coarse matrices P^T A P. The cycle itself is the
+// one of multigrid.h, so the setup is done once and the hierarchy can be
+// applied to any number of right-hand sides.
+
+struct AMGParams
+{
+    /// j is a strong neighbour of i if |a_ij| >= theta * sqrt(a_ii * a_jj)
+    double theta = 0.08;
+    /// Coarsening stops below this many unknowns
+    unsigned coarseSize = 300;
+    /// Upper bound on the number of levels
+    unsigned maxLevels = 25;
+    /// Prolongation smoother I - omega / lmax * D^{-1} A
+    double omega = 4.0 / 3.0;
+    /// The W-cycle keeps iteration counts bounded as aggregates coarsen by ~9 per level
+    MGCycle cycle = MG_W_CYCLE;
+};
+
+/// Replaces the levels of mg with the hierarchy for A (added coarsest
+/// first) and calls mg.setup(). Returns the operator complexity,
+/// the total number of nonzeros of all levels over that of A.
+inline double amg_setup(const CSRMatrix &A, const AMGParams &params, Multigrid &mg, bool verbose = true)
+{
+    // Matrices from the finest down, P[l] maps level l+1 to level l
+    std::vector<CSRMatrix> mats(1, A), prolongations;
+    if(!sa_coarsen(params.theta, params.omega, params.coarseSize, params.maxLevels, mats, prolongations) && verbose)
+        printf("AMG coarsening stopped at %u unknowns\n", mats.back().n);
+
+    double nnz = 0.0;
+    for(const CSRMatrix &M : mats)
+        nnz += M.nnz();
+    if(verbose){
+        printf("AMG levels:");
+        for(const CSRMatrix &M : mats)
+            printf(" %u", M.n);
+        printf(", operator complexity %.2f\n", nnz / A.nnz());
+    }
+
+    mg.clear();
+    mg.cycle = params.cycle;
+    mg.addLevel(mats.back(), CSRMatrix());
+    for(size_t l = mats.size() - 1; l-- > 0; )
+        mg.addLevel(mats[l], prolongations[l]);
+    mg.setup();
+    return nnz / A.nnz();
+}
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef COMMON_CSR_IO_H
+#define COMMON_CSR_IO_H
+
+#include "csr_matrix.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+// Binary CSR matrix and vector files and MatrixMarket conversion.
+//
+// Matrix file (.csrb), little-endian, native layout:
+//   char     magic[8] = "CSRBIN1"
+//   uint64_t n, nnz
+//   uint64_t reserved
+//   uint32_t rowStart[n+1]   (padded to a multiple of 8 bytes)
+//   uint32_t col[nnz]        (padded to a multiple of 8 bytes)
+//   double   val[nnz]
+// Vector file (.vecb):
+//   char     magic[8] = "VECBIN1"
+//   uint64_t n, reserved[2]
+//   double   val[n]
+// Every array starts on an 8-byte boundary, so a mapped file is used in place.
+
+const char CSR_BINARY_MAGIC[8] = "CSRBIN1";
+const char VECTOR_BINARY_MAGIC[8] = "VECBIN1";
+
+struct BinaryHeader
+{
+    char magic[8];
+    uint64_t n, nnz, reserved;
+};
+
+/// Size of an array of 'count' elements of 'size' bytes padded to 8 bytes
+inline size_t csr_io_padded(size_t count, size_t size)
+{
+    return (count * size + 7) / 8 * 8;
+}
+
+inline bool csr_io_write_padded(FILE *f, const void *data, size_t count, size_t size)
+{
+    static const char zeros[8] = {0};
+    size_t bytes = count * size, padded = csr_io_padded(count, size);
+    return (bytes == 0 || fwrite(data, 1, bytes, f) == bytes)
+        && fwrite(zeros, 1, padded - bytes, f) == padded - bytes;
+}
+
+inline bool write_csr_binary(const std::string &file, const CSRMatrix &A)
+{
+    FILE *f = fopen(file.c_str(), "wb");
+    if(!f)
+        return false;
+    BinaryHeader h;
+    memcpy(h.magic, CSR_BINARY_MAGIC, 8);
+    h.n = A.n;
+    h.nnz = A.nnz();
+    h.reserved = 0;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+           && csr_io_write_padded(f, A.rowStart.data(), A.n + 1, sizeof(unsigned))
+           && csr_io_write_padded(f, A.col.data(), A.nnz(), sizeof(unsigned))
+           && csr_io_write_padded(f, A.val.data(), A.nnz(), sizeof(double));
+    return fclose(f) == 0 && ok;
+}
+
+inline bool write_vector_binary(const std::string &file, const std::vector<double> &v)
+{
+    FILE *f = fopen(file.c_str(), "wb");
+    if(!f)
+        return false;
+    BinaryHeader h;
+    memcpy(h.magic, VECTOR_BINARY_MAGIC, 8);
+    h.n = v.size();
+    h.nnz = h.reserved = 0;
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+           && csr_io_write_padded(f, v.data(), v.size(), sizeof(double));
+    return fclose(f) == 0 && ok;
+}
+
+/// Read-only memory mapping of a whole file
+class MappedFile
+{
+public:
+    MappedFile() : data(NULL), size(0) {}
+    ~MappedFile() { close(); }
+
+    bool open(const std::string &file)
+    {
+        close();
+        int fd = ::open(file.c_str(), O_RDONLY);
+        if(fd < 0)
+            return false;
+        struct stat st;
+        if(fstat(fd, &st) != 0 || st.st_size == 0){
+            ::close(fd);
+            return false;
+        }
+        void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        ::close(fd);
+        if(p == MAP_FAILED)
+            return false;
+        data = static_cast<const char *>(p);
+        size = st.st_size;
+        return true;
+    }
+
+    void close()
+    {
+        if(data)
+            munmap(const_cast<char *>(data), size);
+        data = NULL;
+        size = 0;
+    }
+
+    const char *data;
+    size_t size;
+
+private:
+    MappedFile(const MappedFile &);
+    MappedFile &operator=(const MappedFile &);
+};
+
+/// Binary CSR matrix used in place from a mapped file
+class MappedCSR
+{
+public:
+    bool open(const std::string &file)
+    {
+        if(!map.open(file) || map.size < sizeof(BinaryHeader))
+            return false;
+        const BinaryHeader *h = reinterpret_cast<const BinaryHeader *>(map.data);
+        if(memcmp(h->magic, CSR_BINARY_MAGIC, 8))
+            return false;
+        n = h->n;
+        nnz = h->nnz;
+        size_t offCol = sizeof(BinaryHeader) + csr_io_padded(n + 1, sizeof(unsigned));
+        size_t offVal = offCol + csr_io_padded(nnz, sizeof(unsigned));
+        if(offVal + nnz * sizeof(double) > map.size)
+            return false;
+        rowStart = reinterpret_cast<const unsigned *>(map.data + sizeof(BinaryHeader));
+        col = reinterpret_cast<const unsigned *>(map.data + offCol);
+        val = reinterpret_cast<const double *>(map.data + offVal);
+        return true;
+    }
+
+    /// Copy into an owning CSR matrix
+    void copyTo(CSRMatrix &A) const
+    {
+        A.n = static_cast<unsigned>(n);
+        A.rowStart.assign(rowStart, rowStart + n + 1);
+        A.col.assign(col, col + nnz);
+        A.val.assign(val, val + nnz);
+    }
+
+    uint64_t n, nnz;
+    const unsigned *rowStart, *col;
+    const double *val;
+
+private:
+    MappedFile map;
+};
+
+/// Binary vector used in place from a mapped file
+class MappedVector
+{
+public:
+    bool open(const std::string &file)
+    {
+        if(!map.open(file) || map.size < sizeof(BinaryHeader))
+            return false;
+        const BinaryHeader *h = reinterpret_cast<const BinaryHeader *>(map.data);
+        if(memcmp(h->magic, VECTOR_BINARY_MAGIC, 8))
+            return false;
+        n = h->n;
+        if(sizeof(BinaryHeader) + n * sizeof(double) > map.size)
+            return false;
+        val = reinterpret_cast<const double *>(map.data + sizeof(BinaryHeader));
+        return true;
+    }
+
+    uint64_t n;
+    const double *val;
+
+private:
+    MappedFile map;
+};
+
+// =========== MatrixMarket
+
+inline bool write_csr_mtx(const std::string &file, const CSRMatrix &A)
+{
+    FILE *f = fopen(file.c_str(), "w");
+    if(!f)
+        return false;
+    fprintf(f, "%%%%MatrixMarket matrix coordinate real general\n");
+    fprintf(f, "%u %u %u\n", A.n, A.n, A.nnz());
+    for(unsigned r = 0; r < A.n; r++)
+        for(unsigned l = A.rowStart[r]; l < A.rowStart[r + 1]; l++)
+            fprintf(f, "%u %u %.17g\n", r + 1, A.col[l] + 1, A.val[l]);
+    return fclose(f) == 0;
+}
+
+inline bool write_vector_mtx(const std::string &file, const std::vector<double> &v)
+{
+    FILE *f = fopen(file.c_str(), "w");
+    if(!f)
+        return false;
+    fprintf(f, "%%%%MatrixMarket matrix array real general\n");
+    fprintf(f, "%zu 1\n", v.size());
+    for(size_t i = 0; i < v.size(); i++)
+        fprintf(f, "%.17g\n", v[i]);
+    return fclose(f) == 0;
+}
+
+/// Reads a square 'coordinate real' matrix, general or symmetric.
+/// Duplicate entries are summed.
+inline bool read_csr_mtx(const std::string &file, CSRMatrix &A)
+{
+    FILE *f = fopen(file.c_str(), "r");
+    if(!f)
+        return false;
+    char line[1024];
+    if(!fgets(line, sizeof(line), f) || strncmp(line, "%%MatrixMarket matrix coordinate", 32)){
+        fclose(f);
+        return false;
+    }
+    bool symmetric = strstr(line, "symmetric") != NULL;
+    while(fgets(line, sizeof(line), f) && line[0] == '%')
+        ;
+    unsigned rows, cols, entries;
+    if(sscanf(line, "%u %u %u", &rows, &cols, &entries) != 3 || rows != cols){
+        fclose(f);
+        return false;
+    }
+    struct Entry { unsigned r, c; double v; };
+    std::vector<Entry> e;
+    e.reserve(symmetric ? 2 * entries : entries);
+    for(unsigned k = 0; k < entries; k++){
+        Entry x;
+        if(fscanf(f, "%u %u %lf", &x.r, &x.c, &x.v) != 3 || x.r < 1 || x.c < 1 || x.r > rows || x.c > cols){
+            fclose(f);
+            return false;
+        }
+        x.r--;
+        x.c--;
+        e.push_back(x);
+        if(symmetric && x.r != x.c){
+            Entry y = {x.c, x.r, x.v};
+            e.push_back(y);
+        }
+    }
+    fclose(f);
+    std::sort(e.begin(), e.end(), [](const Entry &a, const Entry &b){
+        return a.r < b.r || (a.r == b.r && a.c < b.c);
+    });
+    A.n = rows;
+    A.rowStart.assign(rows + 1, 0);
+    A.col.clear();
+    A.val.clear();
+    for(size_t k = 0; k < e.size(); k++){
+        if(k > 0 && e[k].r == e[k - 1].r && e[k].c == e[k - 1].c){
+            A.val.back() += e[k].v;
+            continue;
+        }
+        A.rowStart[e[k].r + 1]++;
+        A.col.push_back(e[k].c);
+        A.val.push_back(e[k].v);
+    }
+    for(unsigned r = 0; r < rows; r++)
+        A.rowStart[r + 1] += A.rowStart[r];
+    return true;
+}
+
+/// Reads an 'array real' vector (one column)
+inline bool read_vector_mtx(const std::string &file, std::vector<double> &v)
+{
+    FILE *f = fopen(file.c_str(), "r");
+    if(!f)
+        return false;
+    char line[1024];
+    if(!fgets(line, sizeof(line), f) || strncmp(line, "%%MatrixMarket matrix array", 27)){
+        fclose(f);
+        return false;
+    }
+    while(fgets(line, sizeof(line), f) && line[0] == '%')
+        ;
+    unsigned n, m;
+    if(sscanf(line, "%u %u", &n, &m) != 2 || m != 1){
+        fclose(f);
+        return false;
+    }
+    v.resize(n);
+    for(unsigned i = 0; i < n; i++){
+        if(fscanf(f, "%lf", &v[i]) != 1){
+            fclose(f);
+            return false;
+        }
+    }
+    fclose(f);
+    return true;
+}
+
+#endif
@@ -0,0 +1,124 @@
+#ifndef COMMON_CSR_MATRIX_H
+#define COMMON_CSR_MATRIX_H
+
+#include "inmost.h"
+#include <vector>
+#include <algorithm>
+
+/// Sparse matrix in compressed sparse row format, square unless noted.
+/// Columns of a row are stored in increasing order.
+struct CSRMatrix
+{
+    /// Number of rows
+    unsigned n = 0;
+    /// Row r occupies positions rowStart[r], ..., rowStart[r+1]-1 of col and val
+    std::vector<unsigned> rowStart;
+    /// Column indices
+    std::vector<unsigned> col;
+    /// Values
+    std::vector<double> val;
+
+    /// Number of stored entries
+    unsigned nnz() const { return static_cast<unsigned>(col.size()); }
+
+    /// Position of entry (r, c) in col/val, or -1 if it is not in the pattern
+    int slot(unsigned r, unsigned c) const
+    {
+        unsigned lo = rowStart[r], hi = rowStart[r + 1];
+        while(lo < hi){
+            unsigned mid = (lo + hi) / 2;
+            if(col[mid] < c)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+        return (lo < rowStart[r + 1] && col[lo] == c) ? static_cast<int>(lo) : -1;
+    }
+};
+
+/// y = A x
+inline void csr_multiply(const CSRMatrix &A, const double *x, double *y)
+{
+    int n = static_cast<int>(A.n);
+#pragma omp parallel for schedule(static)
+    for(int r = 0; r < n; r++){
+        double s = 0.0;
+        for(unsigned l = A.rowStart[r]; l < A.rowStart[r + 1]; l++)
+            s += A.val[l] * x[A.col[l]];
+        y[r] = s;
+    }
+}
+
+/// Transpose of a rectangular matrix A with numCols columns
+inline void csr_transpose(const CSRMatrix &A, unsigned numCols, CSRMatrix &At)
+{
+    At.n = numCols;
+    At.rowStart.assign(numCols + 1, 0);
+    for(unsigned l = 0; l < A.nnz(); l++)
+        At.rowStart[A.col[l] + 1]++;
+    for(unsigned c = 0; c < numCols; c++)
+        At.rowStart[c + 1] += At.rowStart[c];
+    At.col.resize(A.nnz());
+    At.val.resize(A.nnz());
+    std::vector<unsigned> pos(At.rowStart.begin(), At.rowStart.end() - 1);
+    for(unsigned r = 0; r < A.n; r++){
+        for(unsigned l = A.rowStart[r]; l < A.rowStart[r + 1]; l++){
+            unsigned p = pos[A.col[l]]++;
+            At.col[p] = r;
+            At.val[p] = A.val[l];
+        }
+    }
+}
+
+/// C = A B for rectangular A and B, B has numColsB columns
+inline void csr_matmul(const CSRMatrix &A, const CSRMatrix &B, unsigned numColsB, CSRMatrix &C)
+{
+    C.n = A.n;
+    C.rowStart.assign(A.n + 1, 0);
+    C.col.clear();
+    C.val.clear();
+    // Dense accumulator of one row: position of column c in C, or -1
+    std::vector<int> pos(numColsB, -1);
+    std::vector<std::pair<unsigned, double> > row;
+    for(unsigned r = 0; r < A.n; r++){
+        unsigned first = C.nnz();
+        for(unsigned la = A.rowStart[r]; la < A.rowStart[r + 1]; la++){
+            unsigned k = A.col[la];
+            for(unsigned lb = B.rowStart[k]; lb < B.rowStart[k + 1]; lb++){
+                unsigned c = B.col[lb];
+                if(pos[c] < 0){
+                    pos[c] = static_cast<int>(C.nnz());
+                    C.col.push_back(c);
+                    C.val.push_back(0.0);
+                }
+                C.val[pos[c]] += A.val[la] * B.val[lb];
+            }
+        }
+        // Sort the row by column
+        row.clear();
+        for(unsigned l = first; l < C.nnz(); l++){
+            row.push_back(std::make_pair(C.col[l], C.val[l]));
+            pos[C.col[l]] = -1;
+        }
+        std::sort(row.begin(), row.end());
+        for(unsigned l = first; l < C.nnz(); l++){
+            C.col[l] = row[l - first].first;
+            C.val[l] = row[l - first].second;
+        }
+        C.rowStart[r + 1] = C.nnz();
+    }
+}
+
+/// Copy a CSR matrix into an INMOST matrix with interval [0, A.n)
+inline void csr_to_sparse(const CSRMatrix &A, INMOST::Sparse::Matrix &M)
+{
+    M.SetInterval(0, A.n);
+    for(unsigned r = 0; r < A.n; r++){
+        INMOST::Sparse::Row &row = M[r];
+        row.Clear();
+        for(unsigned l = A.rowStart[r]; l < A.rowStart[r + 1]; l++)
+            row.Push(A.col[l], A.val[l]);
+    }
+}
+
+#endif
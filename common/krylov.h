@@ -0,0 +1,148 @@
+#ifndef COMMON_KRYLOV_H
+#define COMMON_KRYLOV_H
+
+#include <vector>
+#include <cmath>
+#include <algorithm>
+
+// Native Krylov solvers for symmetric positive definite systems.
+// Operators and preconditioners are callables
+//   void op(const double *x, double *y)   // y = A x
+//   void prec(const double *r, double *z) // z = M^{-1} r
+// so that both assembled and matrix-free operators can be used.
+
+/// Outcome of an iterative solve
+struct KrylovStats
+{
+    /// Number of iterations done
+    unsigned iterations = 0;
+    /// Final residual norm relative to the initial one
+    double residual = 0.0;
+    /// Whether the tolerance was reached
+    bool converged = false;
+};
+
+inline double krylov_dot(const std::vector<double> &a, const std::vector<double> &b)
+{
+    double s = 0.0;
+    int n = static_cast<int>(a.size());
+#pragma omp parallel for reduction(+:s) schedule(static)
+    for(int i = 0; i < n; i++)
+        s += a[i] * b[i];
+    return s;
+}
+
+/// Jacobi preconditioner z = D^{-1} r
+struct JacobiPrec
+{
+    std::vector<double> invDiag;
+
+    explicit JacobiPrec(const std::vector<double> &diag) : invDiag(diag.size())
+    {
+        for(size_t i = 0; i < diag.size(); i++)
+            invDiag[i] = 1.0 / diag[i];
+    }
+
+    void operator()(const double *r, double *z) const
+    {
+        int n = static_cast<int>(invDiag.size());
+#pragma omp parallel for schedule(static)
+        for(int i = 0; i < n; i++)
+            z[i] = invDiag[i] * r[i];
+    }
+};
+
+/// Chebyshev polynomial preconditioner: 'degree' steps of Jacobi-scaled
+/// Chebyshev iteration for A z = r started from z = 0.
+/// lmax must bound the spectrum of D^{-1} A from above (e.g. Gershgorin),
+/// eigenvalues below lmin are damped less but keep the polynomial positive.
+template<class Op>
+struct ChebyshevPrec
+{
+    const Op &A;
+    std::vector<double> invDiag;
+    double lmin, lmax;
+    unsigned degree;
+    mutable std::vector<double> d, res;
+
+    ChebyshevPrec(const Op &A_, const std::vector<double> &diag, double lmin_, double lmax_, unsigned degree_)
+        : A(A_), invDiag(diag.size()), lmin(lmin_), lmax(lmax_), degree(degree_), d(diag.size()), res(diag.size())
+    {
+        for(size_t i = 0; i < diag.size(); i++)
+            invDiag[i] = 1.0 / diag[i];
+    }
+
+    void operator()(const double *r, double *z) const
+    {
+        int n = static_cast<int>(invDiag.size());
+        double theta = 0.5 * (lmax + lmin), delta = 0.5 * (lmax - lmin);
+        double sigma = theta / delta, rho = 1.0 / sigma;
+#pragma omp parallel for schedule(static)
+        for(int i = 0; i < n; i++){
+            d[i] = invDiag[i] * r[i] / theta;
+            z[i] = d[i];
+        }
+        for(unsigned k = 1; k < degree; k++){
+            A(z, res.data());
+            double rhoNew = 1.0 / (2.0 * sigma - rho);
+#pragma omp parallel for schedule(static)
+            for(int i = 0; i < n; i++){
+                d[i] = rhoNew * rho * d[i] + 2.0 * rhoNew / delta * invDiag[i] * (r[i] - res[i]);
+                z[i] += d[i];
+            }
+            rho = rhoNew;
+        }
+    }
+};
+
+/// Preconditioned conjugate gradients for A x = b, x holds the initial guess.
+/// Stops when |r| <= max(rtol * |r0|, atol) or after maxIter iterations.
+template<class Op, class Prec>
+KrylovStats pcg(const Op &A, const Prec &M, const std::vector<double> &b, std::vector<double> &x,
+                double rtol, double atol, unsigned maxIter)
+{
+    int n = static_cast<int>(b.size());
+    std::vector<double> r(n), z(n), p(n), q(n);
+    KrylovStats stats;
+
+    A(x.data(), q.data());
+#pragma omp parallel for schedule(static)
+    for(int i = 0; i < n; i++)
+        r[i] = b[i] - q[i];
+    double r0 = std::sqrt(krylov_dot(r, r)), rnorm = r0;
+    double tol = std::max(rtol * r0, atol);
+    if(r0 == 0.0 || rnorm <= tol){
+        stats.converged = true;
+        return stats;
+    }
+
+    M(r.data(), z.data());
+    p = z;
+    double rz = krylov_dot(r, z);
+    while(stats.iterations < maxIter){
+        A(p.data(), q.data());
+        double alpha = rz / krylov_dot(p, q);
+#pragma omp parallel for schedule(static)
+        for(int i = 0; i < n; i++){
+            x[i] += alpha * p[i];
+            r[i] -= alpha * q[i];
+        }
+        stats.iterations++;
+        rnorm = std::sqrt(krylov_dot(r, r));
+        if(rnorm <= tol){
+            stats.converged = true;
+            break;
+        }
+        M(r.data(), z.data());
+        double rzNew = krylov_dot(r, z);
+        double beta = rzNew / rz;
+        rz = rzNew;
+#pragma omp parallel for schedule(static)
+        for(int i = 0; i < n; i++)
+            p[i] = z[i] + beta * p[i];
+    }
+    stats.residual = rnorm / r0;
+    return stats;
+}
+
+#endif
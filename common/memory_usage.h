@@ -0,0 +1,34 @@
+#ifndef COMMON_MEMORY_USAGE_H
+#define COMMON_MEMORY_USAGE_H
+
+#include <stdio.h>
+#include <string.h>
+
+// Resident set size of the current process, read from /proc/self/status.
+// Both functions return 0 where /proc is not available.
+
+inline double proc_status_mb(const char *field)
+{
+    FILE *f = fopen("/proc/self/status", "r");
+    if(!f)
+        return 0.0;
+    char line[256];
+    double kb = 0.0;
+    size_t len = strlen(field);
+    while(fgets(line, sizeof(line), f)){
+        if(!strncmp(line, field, len) && line[len] == ':'){
+            sscanf(line + len + 1, "%lf", &kb);
+            break;
+        }
+    }
+    fclose(f);
+    return kb / 1024.0;
+}
+
+/// Current resident set size in MB
+inline double current_rss_mb() { return proc_status_mb("VmRSS"); }
+
+/// Peak resident set size in MB
+inline double peak_rss_mb() { return proc_status_mb("VmHWM"); }
+
+#endif
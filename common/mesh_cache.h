@@ -0,0 +1,227 @@
+#ifndef COMMON_MESH_CACHE_H
+#define COMMON_MESH_CACHE_H
+
+#include "csr_io.h"
+#include "mesh_gen.h"
+#include "vtk_reader.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Binary cache of meshes read from text files. The cache file of a mesh
+// is named after its source path and records the size, modification time
+// and a content hash of the source. It is written on the first load and
+// memory-mapped afterwards. A source with the recorded size and time is
+// taken as unchanged without being read; otherwise its contents are hashed,
+// and the entry is used only if the hash matches (and is then refreshed).
+// Counts and connectivity of a mapped file are checked before use, and a
+// file that fails the checks is rebuilt from the source.
+//
+// Cache file (.meshb), little-endian, native layout, arrays 8-byte aligned:
+//   char     magic[8] = "MESHBN2"
+//   uint64_t sourceHash, sourceSize
+//   uint64_t numNodes, numCells, numCellNodes
+//   uint64_t sourceMtime             (nanoseconds since the epoch)
+//   uint64_t reserved
+//   double   x[numNodes], y[numNodes]
+//   uint32_t cellStart[numCells+1]   (padded to a multiple of 8 bytes)
+//   uint32_t cellNodes[numCellNodes] (padded)
+//
+//   PolyMesh M;
+//   bool hit;
+//   load_cached_mesh("unit_square6.vtk", "mesh_cache", M, &hit);
+
+const char MESH_CACHE_MAGIC[8] = "MESHBN2";
+
+struct MeshCacheHeader
+{
+    char magic[8];
+    uint64_t sourceHash, sourceSize;
+    uint64_t numNodes, numCells, numCellNodes;
+    uint64_t sourceMtime;
+    uint64_t reserved;
+};
+
+/// 64-bit hash of a byte string, 8 bytes per step (not cryptographic)
+inline uint64_t mesh_cache_hash(const char *data, size_t size)
+{
+    const uint64_t k1 = 0x87c37b91114253d5ull, k2 = 0x4cf5ad432745937full;
+    uint64_t h = 0x9e3779b97f4a7c15ull ^ size;
+    size_t words = size / 8;
+    for(size_t i = 0; i < words; i++){
+        uint64_t w;
+        memcpy(&w, data + 8 * i, 8);
+        h ^= w * k1;
+        h = (h << 31 | h >> 33) * k2;
+    }
+    uint64_t tail = 0;
+    memcpy(&tail, data + 8 * words, size - 8 * words);
+    h ^= tail * k1;
+    // Final avalanche
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+/// Writes the cache file through a temporary and a rename, so that a
+/// concurrent run never maps a partial file
+inline bool write_mesh_cache(const std::string &file, const PolyMesh &M, uint64_t sourceHash, uint64_t sourceSize,
+                             uint64_t sourceMtime)
+{
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), ".tmp%ld", static_cast<long>(getpid()));
+    std::string tmp = file + suffix;
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if(!f)
+        return false;
+    MeshCacheHeader h;
+    memset(&h, 0, sizeof(h));
+    memcpy(h.magic, MESH_CACHE_MAGIC, 8);
+    h.sourceHash = sourceHash;
+    h.sourceSize = sourceSize;
+    h.sourceMtime = sourceMtime;
+    h.numNodes = M.numNodes();
+    h.numCells = M.numCells();
+    h.numCellNodes = M.cellNodes.size();
+    bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+           && csr_io_write_padded(f, M.x.data(), M.x.size(), sizeof(double))
+           && csr_io_write_padded(f, M.y.data(), M.y.size(), sizeof(double))
+           && csr_io_write_padded(f, M.cellStart.data(), M.cellStart.size(), sizeof(unsigned))
+           && csr_io_write_padded(f, M.cellNodes.data(), M.cellNodes.size(), sizeof(unsigned));
+    ok = fclose(f) == 0 && ok && rename(tmp.c_str(), file.c_str()) == 0;
+    if(!ok)
+        remove(tmp.c_str());
+    return ok;
+}
+
+/// Cached mesh used in place from a mapped file
+class MappedMesh
+{
+public:
+    MappedMesh() : x(NULL), y(NULL), cellStart(NULL), cellNodes(NULL) {}
+
+    /// False if the file is missing, foreign, truncated or inconsistent:
+    /// counts that do not match the file size, cellStart not increasing by
+    /// at least 3 from 0 to numCellNodes, or node indices out of range
+    bool open(const std::string &file)
+    {
+        if(!map.open(file) || map.size < sizeof(MeshCacheHeader))
+            return false;
+        const MeshCacheHeader *h = reinterpret_cast<const MeshCacheHeader *>(map.data);
+        if(memcmp(h->magic, MESH_CACHE_MAGIC, 8))
+            return false;
+        header = *h;
+        // Bound the counts by the file size first, so the offsets cannot overflow;
+        // indices and cellStart are 32-bit
+        uint64_t maxCount = std::min<uint64_t>(map.size / sizeof(unsigned), UINT32_MAX - 1);
+        if(h->numNodes > maxCount || h->numCells > maxCount || h->numCellNodes > maxCount)
+            return false;
+        uint64_t offY = sizeof(MeshCacheHeader) + csr_io_padded(h->numNodes, sizeof(double));
+        uint64_t offStart = offY + csr_io_padded(h->numNodes, sizeof(double));
+        uint64_t offNodes = offStart + csr_io_padded(h->numCells + 1, sizeof(unsigned));
+        if(offNodes + csr_io_padded(h->numCellNodes, sizeof(unsigned)) != map.size)
+            return false;
+        x = reinterpret_cast<const double *>(map.data + sizeof(MeshCacheHeader));
+        y = reinterpret_cast<const double *>(map.data + offY);
+        cellStart = reinterpret_cast<const unsigned *>(map.data + offStart);
+        cellNodes = reinterpret_cast<const unsigned *>(map.data + offNodes);
+        if(cellStart[0] != 0 || cellStart[h->numCells] != h->numCellNodes)
+            return false;
+        for(uint64_t c = 0; c < h->numCells; c++)
+            if(cellStart[c + 1] < static_cast<uint64_t>(cellStart[c]) + 3)
+                return false;
+        for(uint64_t i = 0; i < h->numCellNodes; i++)
+            if(cellNodes[i] >= h->numNodes)
+                return false;
+        return true;
+    }
+
+    /// Copy into an owning mesh
+    void copyTo(PolyMesh &M) const
+    {
+        M.x.assign(x, x + header.numNodes);
+        M.y.assign(y, y + header.numNodes);
+        M.cellStart.assign(cellStart, cellStart + header.numCells + 1);
+        M.cellNodes.assign(cellNodes, cellNodes + header.numCellNodes);
+    }
+
+    MeshCacheHeader header;
+    const double *x, *y;
+    const unsigned *cellStart, *cellNodes;
+
+private:
+    MappedFile map;
+};
+
+/// Cache file of a source: dir/<name>-<hash of the absolute path>.meshb
+inline std::string mesh_cache_file(const std::string &dir, const std::string &source)
+{
+    char resolved[PATH_MAX];
+    std::string path = realpath(source.c_str(), resolved) ? std::string(resolved) : source;
+    size_t slash = source.find_last_of('/');
+    std::string name = slash == std::string::npos ? source : source.substr(slash + 1);
+    char key[32];
+    snprintf(key, sizeof(key), "-%016llx.meshb", static_cast<unsigned long long>(mesh_cache_hash(path.data(), path.size())));
+    return dir + "/" + name + key;
+}
+
+/// Mesh of 'source' from its cache in 'dir' if there is a valid one,
+/// otherwise read by read_vtk (or Mesh::Load for files it does not handle)
+/// and added to the cache; 'dir' is created if needed. *hit tells which.
+/// False if the source cannot be read; a failed cache write only prints.
+inline bool load_cached_mesh(const std::string &source, const std::string &dir, PolyMesh &M, bool *hit = NULL)
+{
+    struct stat st;
+    if(stat(source.c_str(), &st) != 0)
+        return false;
+    uint64_t size = static_cast<uint64_t>(st.st_size);
+    uint64_t mtime = static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + static_cast<uint64_t>(st.st_mtim.tv_nsec);
+    std::string cache = mesh_cache_file(dir, source);
+    MappedMesh mapped;
+    bool valid = mapped.open(cache);
+    // A damaged entry is a miss: the source is parsed and the entry rewritten
+    if(!valid && access(cache.c_str(), F_OK) == 0)
+        printf("Mesh cache %s is invalid, rebuilding it\n", cache.c_str());
+    bool found = valid && mapped.header.sourceSize == size;
+    // Same size and time: unchanged, the source is not read at all
+    if(found && mapped.header.sourceMtime == mtime){
+        if(hit)
+            *hit = true;
+        mapped.copyTo(M);
+        return true;
+    }
+    uint64_t hash;
+    {
+        MappedFile src;
+        if(!src.open(source))
+            return false;
+        hash = mesh_cache_hash(src.data, src.size);
+    }
+    found = found && mapped.header.sourceHash == hash;
+    if(hit)
+        *hit = found;
+    if(found)
+        mapped.copyTo(M);
+    else if(!read_vtk(source, M)){
+        INMOST::Mesh m;
+        m.Load(source);
+        mesh_to_poly(m, M);
+    }
+    // New entry, or a touched but unchanged source: record the current time
+    mkdir(dir.c_str(), 0777);
+    if(!write_mesh_cache(cache, M, hash, size, mtime))
+        printf("Cannot write mesh cache %s\n", cache.c_str());
+    return true;
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef COMMON_MESH_GEN_H
+#define COMMON_MESH_GEN_H
+
+#include "inmost.h"
+#include "tri_mesh.h"
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+// In-memory meshes of the unit square (the square.geo domain) and uniform
+// refinement, so that large benchmark meshes need no file I/O.
+// Meshes are kept in flat arrays while they are built and refined, and
+// handed to INMOST once at the end (see load_mesh in mesh_load.h).
+//
+//   PolyMesh M, fine;
+//   unit_square_mesh(2048, false, M);     // 2 * 2048^2 triangles
+//   refine_uniform(M, fine);
+//   poly_to_mesh(fine, m);
+
+/// Planar polygonal mesh: cell c has the nodes
+/// cellNodes[cellStart[c]], ..., cellNodes[cellStart[c+1]-1], counterclockwise
+struct PolyMesh
+{
+    std::vector<double> x, y;
+    std::vector<unsigned> cellStart, cellNodes;
+
+    unsigned numNodes() const { return static_cast<unsigned>(x.size()); }
+    unsigned numCells() const { return cellStart.empty() ? 0 : static_cast<unsigned>(cellStart.size() - 1); }
+};
+
+/// Structured n x n mesh of the unit square: squares, or squares cut
+/// into two triangles along the diagonal from (i, j) to (i+1, j+1)
+inline void unit_square_mesh(unsigned n, bool quads, PolyMesh &M)
+{
+    M.x.resize(static_cast<size_t>(n + 1) * (n + 1));
+    M.y.resize(M.x.size());
+    for(unsigned j = 0; j <= n; j++){
+        for(unsigned i = 0; i <= n; i++){
+            M.x[j * (n + 1) + i] = static_cast<double>(i) / n;
+            M.y[j * (n + 1) + i] = static_cast<double>(j) / n;
+        }
+    }
+    M.cellStart.assign(1, 0);
+    M.cellNodes.clear();
+    M.cellNodes.reserve(static_cast<size_t>(n) * n * (quads ? 4 : 6));
+    for(unsigned j = 0; j < n; j++){
+        for(unsigned i = 0; i < n; i++){
+            unsigned a = j * (n + 1) + i, b = a + 1, c = a + n + 2, d = a + n + 1;
+            if(quads){
+                unsigned q[4] = {a, b, c, d};
+                M.cellNodes.insert(M.cellNodes.end(), q, q + 4);
+                M.cellStart.push_back(static_cast<unsigned>(M.cellNodes.size()));
+            }
+            else{
+                unsigned t[6] = {a, b, c, a, c, d};
+                M.cellNodes.insert(M.cellNodes.end(), t, t + 3);
+                M.cellStart.push_back(static_cast<unsigned>(M.cellNodes.size()));
+                M.cellNodes.insert(M.cellNodes.end(), t + 3, t + 6);
+                M.cellStart.push_back(static_cast<unsigned>(M.cellNodes.size()));
+            }
+        }
+    }
+}
+
+/// Uniform refinement with every edge bisected: triangles are split into 4
+/// by their edge midpoints (red refinement, numbered as refine_red in
+/// tri_mesh.h does), other polygons with k nodes into k quads around their
+/// vertex average. Coarse nodes keep their indices; the children of a cell
+/// are consecutive.
+inline void refine_uniform(const PolyMesh &coarse, PolyMesh &fine)
+{
+    unsigned nc = coarse.numCells();
+    size_t numSides = coarse.cellNodes.size();
+    // Side l goes from node l of its cell to the next one
+    std::vector<uint64_t> side(numSides);
+    for(unsigned c = 0; c < nc; c++){
+        unsigned first = coarse.cellStart[c], last = coarse.cellStart[c + 1];
+        for(unsigned l = first; l < last; l++){
+            uint64_t a = coarse.cellNodes[l], b = coarse.cellNodes[l + 1 < last ? l + 1 : first];
+            side[l] = std::min(a, b) << 32 | std::max(a, b);
+        }
+    }
+    fine.x = coarse.x;
+    fine.y = coarse.y;
+    std::vector<unsigned> mid;
+    bisect_sides(side, fine.x, fine.y, mid, NULL, NULL);
+
+    fine.cellStart.assign(1, 0);
+    fine.cellNodes.clear();
+    fine.cellNodes.reserve(4 * numSides);
+    for(unsigned c = 0; c < nc; c++){
+        unsigned first = coarse.cellStart[c], k = coarse.cellStart[c + 1] - first;
+        const unsigned *v = &coarse.cellNodes[first];
+        const unsigned *m = &mid[first];
+        if(k == 3){
+            unsigned children[12];
+            red_children(v, m, children);
+            for(unsigned t = 0; t < 4; t++){
+                fine.cellNodes.insert(fine.cellNodes.end(), children + 3 * t, children + 3 * t + 3);
+                fine.cellStart.push_back(static_cast<unsigned>(fine.cellNodes.size()));
+            }
+            continue;
+        }
+        unsigned center = fine.numNodes();
+        double cx = 0.0, cy = 0.0;
+        for(unsigned i = 0; i < k; i++){
+            cx += coarse.x[v[i]];
+            cy += coarse.y[v[i]];
+        }
+        fine.x.push_back(cx / k);
+        fine.y.push_back(cy / k);
+        for(unsigned i = 0; i < k; i++){
+            unsigned q[4] = {v[i], m[i], center, m[(i + k - 1) % k]};
+            fine.cellNodes.insert(fine.cellNodes.end(), q, q + 4);
+            fine.cellStart.push_back(static_cast<unsigned>(fine.cellNodes.size()));
+        }
+    }
+}
+
+/// Nodes on sides that belong to one cell only
+inline void poly_boundary_nodes(const PolyMesh &M, std::vector<unsigned char> &boundary)
+{
+    std::vector<uint64_t> sides;
+    sides.reserve(M.cellNodes.size());
+    for(unsigned c = 0; c < M.numCells(); c++){
+        unsigned first = M.cellStart[c], last = M.cellStart[c + 1];
+        for(unsigned l = first; l < last; l++){
+            uint64_t a = M.cellNodes[l], b = M.cellNodes[l + 1 < last ? l + 1 : first];
+            sides.push_back(std::min(a, b) << 32 | std::max(a, b));
+        }
+    }
+    std::sort(sides.begin(), sides.end());
+    boundary.assign(M.numNodes(), 0);
+    for(size_t s = 0; s < sides.size(); ){
+        size_t e = s + 1;
+        while(e < sides.size() && sides[e] == sides[s])
+            e++;
+        if(e - s == 1){
+            boundary[sides[s] >> 32] = 1;
+            boundary[sides[s] & 0xffffffffu] = 1;
+        }
+        s = e;
+    }
+}
+
+/// Triangle mesh of M with boundary flags for the multigrid hierarchy;
+/// false if M has other cells than triangles
+inline bool poly_to_tri(const PolyMesh &M, TriMesh &T)
+{
+    for(unsigned c = 0; c < M.numCells(); c++)
+        if(M.cellStart[c + 1] - M.cellStart[c] != 3)
+            return false;
+    T.x = M.x;
+    T.y = M.y;
+    T.tri = M.cellNodes;
+    std::vector<unsigned char> boundary;
+    poly_boundary_nodes(M, boundary);
+    T.boundary.assign(boundary.begin(), boundary.end());
+    return true;
+}
+
+/// Flat copy of the cells of a 2D mesh, nodes numbered in iteration order
+inline void mesh_to_poly(INMOST::Mesh &m, PolyMesh &M)
+{
+    std::vector<unsigned> index(m.NodeLastLocalID());
+    M.x.clear();
+    M.y.clear();
+    for(INMOST::Mesh::iteratorNode inode = m.BeginNode(); inode != m.EndNode(); inode++){
+        index[inode->LocalID()] = M.numNodes();
+        M.x.push_back(inode->getAsNode().Coords()[0]);
+        M.y.push_back(inode->getAsNode().Coords()[1]);
+    }
+    M.cellStart.assign(1, 0);
+    M.cellNodes.clear();
+    for(INMOST::Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
+        INMOST::ElementArray<INMOST::Node> nodes = icell->getAsCell().getNodes();
+        // Counterclockwise order
+        double area2 = 0.0;
+        for(unsigned i = 0; i < nodes.size(); i++){
+            const INMOST::Node &p = nodes[i], &q = nodes[(i + 1) % nodes.size()];
+            area2 += p.Coords()[0] * q.Coords()[1] - q.Coords()[0] * p.Coords()[1];
+        }
+        size_t first = M.cellNodes.size();
+        for(unsigned i = 0; i < nodes.size(); i++)
+            M.cellNodes.push_back(index[nodes[i].LocalID()]);
+        if(area2 < 0.0)
+            std::reverse(M.cellNodes.begin() + first, M.cellNodes.end());
+        M.cellStart.push_back(static_cast<unsigned>(M.cellNodes.size()));
+    }
+}
+
+/// Creates the nodes and cells of M in the empty 2D mesh m; the faces
+/// of a cell are its sides, as when a 2D VTK file is loaded
+inline void poly_to_mesh(const PolyMesh &M, INMOST::Mesh &m)
+{
+    m.SetDimensions(2);
+    std::vector<INMOST::Node> nodes(M.numNodes());
+    for(unsigned v = 0; v < M.numNodes(); v++){
+        double xyz[3] = {M.x[v], M.y[v], 0.0};
+        nodes[v] = m.CreateNode(xyz);
+    }
+    std::vector<INMOST::integer> sideNodes, sideSizes;
+    for(unsigned c = 0; c < M.numCells(); c++){
+        unsigned first = M.cellStart[c], k = M.cellStart[c + 1] - first;
+        INMOST::ElementArray<INMOST::Node> cellNodes(&m);
+        sideNodes.resize(2 * k);
+        sideSizes.assign(k, 2);
+        for(unsigned i = 0; i < k; i++){
+            cellNodes.push_back(nodes[M.cellNodes[first + i]]);
+            sideNodes[2 * i] = static_cast<INMOST::integer>(i);
+            sideNodes[2 * i + 1] = static_cast<INMOST::integer>((i + 1) % k);
+        }
+        m.CreateCell(cellNodes, sideNodes.data(), sideSizes.data(), static_cast<INMOST::integer>(k), cellNodes);
+    }
+}
+
+#endif
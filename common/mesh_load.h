@@ -0,0 +1,88 @@
+#ifndef COMMON_MESH_LOAD_H
+#define COMMON_MESH_LOAD_H
+
+#include "inmost.h"
+#include "mesh_gen.h"
+#include "vtk_reader.h"
+#include "mesh_cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+
+// Mesh input of the drivers: a file, or a structured mesh of the unit
+// square generated in memory, optionally refined uniformly.
+//
+//   Mesh m;
+//   MeshLoadOptions opt;
+//   opt.refine = 2;
+//   load_mesh(m, "tri:2048", opt);           // 2 * 2048^2 * 16 triangles
+//   load_mesh(m, "unit_square3.vtk", opt);   // file, refined twice
+//   opt.cacheDir = "mesh_cache";
+//   load_mesh(m, "unit_square3.vtk", opt);   // parsed once, mapped afterwards
+//   PolyMesh coarse;
+//   load_mesh(m, "tri:16", opt, &coarse);    // coarse: the mesh before refining
+
+struct MeshLoadOptions
+{
+    /// Uniform refinements (refine_uniform) after loading
+    unsigned refine = 0;
+    /// Read .vtk files with read_vtk instead of Mesh::Load
+    bool fastVtk = false;
+    /// Directory of the binary mesh cache (mesh_cache.h), none if empty
+    std::string cacheDir;
+};
+
+inline bool mesh_load_is_vtk(const std::string &file)
+{
+    return file.size() > 4 && file.compare(file.size() - 4, 4, ".vtk") == 0;
+}
+
+/// Fills the empty mesh m from 'spec':
+///   tri:N, quad:N   structured N x N mesh of the unit square
+///   anything else   mesh file, through the cache in opt.cacheDir if set;
+///                   otherwise .vtk files are read by read_vtk when refined
+///                   or with opt.fastVtk, by Mesh::Load otherwise (and
+///                   whenever read_vtk does not handle the file)
+/// If 'base' is given it gets the mesh before the refinements whenever the
+/// mesh is built from flat arrays (tri:/quad:, a cache, or opt.refine > 0),
+/// and is left empty when m comes straight from Mesh::Load.
+/// Returns false for a malformed tri:/quad: spec or an unreadable cached file.
+inline bool load_mesh(INMOST::Mesh &m, const std::string &spec, const MeshLoadOptions &opt, PolyMesh *base = NULL)
+{
+    PolyMesh M;
+    bool tri = spec.compare(0, 4, "tri:") == 0, quad = spec.compare(0, 5, "quad:") == 0;
+    if(tri || quad){
+        int n = atoi(spec.c_str() + (tri ? 4 : 5));
+        if(n <= 0)
+            return false;
+        unit_square_mesh(static_cast<unsigned>(n), quad, M);
+    }
+    else if(!opt.cacheDir.empty()){
+        bool hit;
+        if(!load_cached_mesh(spec, opt.cacheDir, M, &hit))
+            return false;
+        printf("Mesh cache %s for %s\n", hit ? "hit" : "miss", spec.c_str());
+    }
+    else if(!((opt.fastVtk || opt.refine > 0) && mesh_load_is_vtk(spec) && read_vtk(spec, M))){
+        if(opt.refine == 0){
+            m.Load(spec);
+            if(base)
+                *base = PolyMesh();
+            return true;
+        }
+        INMOST::Mesh file;
+        file.Load(spec);
+        mesh_to_poly(file, M);
+    }
+    if(base)
+        *base = M;
+    for(unsigned r = 0; r < opt.refine; r++){
+        PolyMesh fine;
+        refine_uniform(M, fine);
+        std::swap(M, fine);
+    }
+    poly_to_mesh(M, m);
+    return true;
+}
+
+#endif
@@ -0,0 +1,304 @@
+#ifndef COMMON_MULTIGRID_H
+#define COMMON_MULTIGRID_H
+
+#include "csr_matrix.h"
+#include "krylov.h"
+#include "aggregation.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// Geometric multigrid on a hierarchy of assembled levels.
+// Levels are added from the coarsest to the finest, every level but the
+// coarsest with the prolongation from the previous one. Smoothing is
+// Chebyshev-Jacobi (symmetric and thread-parallel), the coarsest level is
+// solved by dense Cholesky, so one V- or W-cycle from a zero guess is a
+// symmetric positive definite preconditioner usable in pcg(). A coarsest
+// level too large for that is first coarsened further by smoothed
+// aggregation (aggregation.h); if that stalls, it is solved by Jacobi PCG
+// to a tight tolerance instead.
+//
+//   Multigrid mg;                       // not copyable
+//   mg.addLevel(A0, CSRMatrix());
+//   mg.addLevel(A1, P1);
+//   mg.setup();
+//   pcg(A, mg, b, x, ...);   // or mg.solve(b, x, ...)
+
+/// Cycle shape: number of visits of the next coarser level
+enum MGCycle
+{
+    MG_V_CYCLE = 1,
+    MG_W_CYCLE = 2
+};
+
+/// Largest coarsest level solved by dense Cholesky
+const unsigned MG_DENSE_COARSE_MAX = 400;
+/// Relative tolerance of the PCG coarse solve used when aggregation stalls above that size
+const double MG_COARSE_RTOL = 1e-12;
+
+/// y = A x for an assembled matrix
+struct CSROperator
+{
+    const CSRMatrix *A;
+    void operator()(const double *x, double *y) const { csr_multiply(*A, x, y); }
+};
+
+class Multigrid
+{
+public:
+    /// Cycle shape
+    MGCycle cycle = MG_V_CYCLE;
+    /// Degree of the Chebyshev smoother, used before and after the coarse correction
+    unsigned smoothDegree = 2;
+    /// The smoother targets eigenvalues of D^{-1} A in [lmax / smoothRange, lmax]
+    double smoothRange = 10.0;
+    /// Strength threshold of the aggregation below a coarsest level of more than MG_DENSE_COARSE_MAX unknowns
+    double aggregationTheta = 0.08;
+
+    Multigrid() {}
+    /// The smoothers point into the levels, so a copy would dangle
+    Multigrid(const Multigrid &) = delete;
+    Multigrid &operator=(const Multigrid &) = delete;
+
+    /// Matrix of the level and the prolongation from the previous (coarser) level
+    void addLevel(const CSRMatrix &A, const CSRMatrix &P)
+    {
+        levels.push_back(Level());
+        levels.back().A = A;
+        levels.back().P = P;
+    }
+
+    /// Drops all levels, e.g. before a new setup for another matrix
+    void clear()
+    {
+        smoothers.clear();
+        levels.clear();
+        coarseL.clear();
+    }
+
+    /// Levels after setup(), including those added by aggregation
+    unsigned numLevels() const { return static_cast<unsigned>(levels.size()); }
+    const CSRMatrix &matrix(unsigned l) const { return levels[l].A; }
+    const CSRMatrix &prolongation(unsigned l) const { return levels[l].P; }
+
+    /// Restrictions, smoothers and the coarse factorization; call after the last addLevel
+    void setup()
+    {
+        coarsenBottom();
+        smoothers.clear();
+        smoothers.reserve(levels.size());
+        for(size_t l = 0; l < levels.size(); l++){
+            Level &L = levels[l];
+            unsigned n = L.A.n;
+            L.op.A = &L.A;
+            if(l > 0)
+                csr_transpose(L.P, levels[l - 1].A.n, L.R);
+            // Diagonal and Gershgorin bound on the spectrum of D^{-1} A
+            std::vector<double> diag(n, 1.0);
+            double lmax = 0.0;
+            for(unsigned r = 0; r < n; r++){
+                double absSum = 0.0;
+                for(unsigned k = L.A.rowStart[r]; k < L.A.rowStart[r + 1]; k++){
+                    if(L.A.col[k] == r)
+                        diag[r] = L.A.val[k];
+                    absSum += fabs(L.A.val[k]);
+                }
+                lmax = std::max(lmax, absSum / diag[r]);
+            }
+            smoothers.push_back(ChebyshevPrec<CSROperator>(L.op, diag, lmax / smoothRange, lmax, smoothDegree));
+            L.x.assign(n, 0.0);
+            L.b.assign(n, 0.0);
+            L.r.assign(n, 0.0);
+            L.z.assign(n, 0.0);
+        }
+        factorCoarse();
+    }
+
+    /// Preconditioner: z = one cycle for A z = r from z = 0 on the finest level
+    void operator()(const double *r, double *z) const
+    {
+        const Level &F = levels.back();
+        std::copy(r, r + F.A.n, F.b.begin());
+        std::fill(F.x.begin(), F.x.end(), 0.0);
+        cycleAt(levels.size() - 1);
+        std::copy(F.x.begin(), F.x.end(), z);
+    }
+
+    /// Standalone solver: cycles x += MG(b - A x) until
+    /// |r| <= max(rtol * |r0|, atol) or maxCycles are done
+    KrylovStats solve(const std::vector<double> &b, std::vector<double> &x, double rtol, double atol, unsigned maxCycles) const
+    {
+        const CSRMatrix &A = levels.back().A;
+        int n = static_cast<int>(A.n);
+        std::vector<double> r(n), e(n);
+        KrylovStats stats;
+        double r0 = 0.0;
+        for(;;){
+            csr_multiply(A, x.data(), r.data());
+#pragma omp parallel for schedule(static)
+            for(int i = 0; i < n; i++)
+                r[i] = b[i] - r[i];
+            double rnorm = std::sqrt(krylov_dot(r, r));
+            if(stats.iterations == 0)
+                r0 = rnorm;
+            stats.residual = r0 > 0.0 ? rnorm / r0 : 0.0;
+            if(rnorm <= std::max(rtol * r0, atol)){
+                stats.converged = true;
+                break;
+            }
+            if(stats.iterations == maxCycles)
+                break;
+            (*this)(r.data(), e.data());
+#pragma omp parallel for schedule(static)
+            for(int i = 0; i < n; i++)
+                x[i] += e[i];
+            stats.iterations++;
+        }
+        return stats;
+    }
+
+private:
+    struct Level
+    {
+        CSRMatrix A, P, R;
+        CSROperator op;
+        /// Solution, right-hand side and work vectors of the cycle
+        mutable std::vector<double> x, b, r, z;
+    };
+    std::vector<Level> levels;
+    std::vector<ChebyshevPrec<CSROperator> > smoothers;
+    /// Dense Cholesky factor of the coarsest matrix, row-major lower triangle,
+    /// empty if the coarsest level is solved by PCG
+    std::vector<double> coarseL;
+    /// Diagonal of the coarsest matrix for the PCG coarse solve
+    std::vector<double> coarseDiag;
+
+    /// Puts aggregation levels below a coarsest level too large for dense Cholesky
+    void coarsenBottom()
+    {
+        if(levels.empty() || levels[0].A.n <= MG_DENSE_COARSE_MAX)
+            return;
+        unsigned n = levels[0].A.n;
+        std::vector<CSRMatrix> mats(1, levels[0].A), prolongations;
+        sa_coarsen(aggregationTheta, 4.0 / 3.0, MG_DENSE_COARSE_MAX, 25, mats, prolongations);
+        if(mats.size() == 1)
+            return;
+        // mats[k] becomes level mats.size() - 1 - k
+        std::vector<Level> bottom(mats.size() - 1);
+        for(size_t k = 1; k < mats.size(); k++){
+            Level &L = bottom[mats.size() - 1 - k];
+            L.A = mats[k];
+            if(k + 1 < mats.size())
+                L.P = prolongations[k];
+        }
+        levels[0].P = prolongations[0];
+        levels.insert(levels.begin(), bottom.begin(), bottom.end());
+        printf("Multigrid: coarsest level of %u unknowns coarsened by aggregation to", n);
+        for(size_t k = 1; k < mats.size(); k++)
+            printf(" %u", mats[k].n);
+        printf("\n");
+    }
+
+    void factorCoarse()
+    {
+        const CSRMatrix &A = levels[0].A;
+        unsigned n = A.n;
+        coarseL.clear();
+        coarseDiag.clear();
+        if(n > MG_DENSE_COARSE_MAX){
+            coarseDiag.assign(n, 1.0);
+            for(unsigned r = 0; r < n; r++)
+                for(unsigned k = A.rowStart[r]; k < A.rowStart[r + 1]; k++)
+                    if(A.col[k] == r)
+                        coarseDiag[r] = A.val[k];
+            printf("Multigrid: coarsest level of %u unknowns is solved by Jacobi PCG\n", n);
+            return;
+        }
+        coarseL.assign(static_cast<size_t>(n) * n, 0.0);
+        for(unsigned r = 0; r < n; r++)
+            for(unsigned k = A.rowStart[r]; k < A.rowStart[r + 1]; k++)
+                coarseL[static_cast<size_t>(r) * n + A.col[k]] = A.val[k];
+        for(unsigned j = 0; j < n; j++){
+            double *Lj = &coarseL[static_cast<size_t>(j) * n];
+            for(unsigned k = 0; k < j; k++)
+                Lj[j] -= Lj[k] * Lj[k];
+            Lj[j] = sqrt(Lj[j]);
+            for(unsigned i = j + 1; i < n; i++){
+                double *Li = &coarseL[static_cast<size_t>(i) * n];
+                for(unsigned k = 0; k < j; k++)
+                    Li[j] -= Li[k] * Lj[k];
+                Li[j] /= Lj[j];
+            }
+        }
+    }
+
+    void solveCoarse() const
+    {
+        const Level &C = levels[0];
+        unsigned n = C.A.n;
+        if(coarseL.empty()){
+            // x is zero on entry: the coarsest level is only visited from zero
+            JacobiPrec prec(coarseDiag);
+            pcg(C.op, prec, C.b, C.x, MG_COARSE_RTOL, 0.0, 10 * n);
+            return;
+        }
+        for(unsigned i = 0; i < n; i++){
+            double s = C.b[i];
+            for(unsigned k = 0; k < i; k++)
+                s -= coarseL[static_cast<size_t>(i) * n + k] * C.x[k];
+            C.x[i] = s / coarseL[static_cast<size_t>(i) * n + i];
+        }
+        for(unsigned i = n; i-- > 0; ){
+            double s = C.x[i];
+            for(unsigned k = i + 1; k < n; k++)
+                s -= coarseL[static_cast<size_t>(k) * n + i] * C.x[k];
+            C.x[i] = s / coarseL[static_cast<size_t>(i) * n + i];
+        }
+    }
+
+    /// x += S (b - A x) on level l
+    void smooth(size_t l) const
+    {
+        const Level &L = levels[l];
+        int n = static_cast<int>(L.A.n);
+        csr_multiply(L.A, L.x.data(), L.r.data());
+#pragma omp parallel for schedule(static)
+        for(int i = 0; i < n; i++)
+            L.r[i] = L.b[i] - L.r[i];
+        smoothers[l](L.r.data(), L.z.data());
+#pragma omp parallel for schedule(static)
+        for(int i = 0; i < n; i++)
+            L.x[i] += L.z[i];
+    }
+
+    void cycleAt(size_t l) const
+    {
+        if(l == 0){
+            solveCoarse();
+            return;
+        }
+        const Level &L = levels[l], &C = levels[l - 1];
+        int n = static_cast<int>(L.A.n);
+        smooth(l);
+        // Restrict the residual, solve for the correction from zero
+        csr_multiply(L.A, L.x.data(), L.r.data());
+#pragma omp parallel for schedule(static)
+        for(int i = 0; i < n; i++)
+            L.r[i] = L.b[i] - L.r[i];
+        csr_multiply(L.R, L.r.data(), C.b.data());
+        std::fill(C.x.begin(), C.x.end(), 0.0);
+        // The coarsest level is solved exactly, once is enough
+        unsigned visits = l == 1 ? 1 : static_cast<unsigned>(cycle);
+        for(unsigned v = 0; v < visits; v++)
+            cycleAt(l - 1);
+        // Prolongate the correction
+        csr_multiply(L.P, C.x.data(), L.z.data());
+#pragma omp parallel for schedule(static)
+        for(int i = 0; i < n; i++)
+            L.x[i] += L.z[i];
+        smooth(l);
+    }
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef COMMON_OUTPUT_H
+#define COMMON_OUTPUT_H
+
+#include "inmost.h"
+#include "vtu_writer.h"
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+
+// Output policy of the solvers: the format (legacy VTK through Mesh::Save,
+// VTU through a VTUWriter, or none at all for benchmarks that only want
+// norms and timings) and the tags written. The time series stride is the
+// outputEvery of the solvers' TransientParams.
+
+enum OutputFormat
+{
+    OUTPUT_VTK = 0,
+    OUTPUT_VTU = 1,
+    /// In situ: nothing is written, no file is touched
+    OUTPUT_NONE = 2
+};
+
+struct OutputParams
+{
+    OutputFormat format = OUTPUT_VTK;
+    /// Tags written; empty for all of them in VTK, the solver's default list in VTU
+    std::vector<std::string> fields;
+};
+
+inline bool parse_output_format(const char *name, OutputFormat &format)
+{
+    if(!strcmp(name, "vtk"))
+        format = OUTPUT_VTK;
+    else if(!strcmp(name, "vtu"))
+        format = OUTPUT_VTU;
+    else if(!strcmp(name, "none"))
+        format = OUTPUT_NONE;
+    else
+        return false;
+    return true;
+}
+
+/// Restricts Mesh::Save to the tags of 'all' that are in 'fields' (all of
+/// them if 'fields' is empty) by setting the "Tag:<name>" file option of
+/// the others to "nosave".
+/// Returns false if 'fields' names a tag not in 'all'.
+inline bool output_select_tags(INMOST::Mesh &m, const std::vector<std::string> &all, const std::vector<std::string> &fields)
+{
+    bool ok = true;
+    for(const std::string &name : fields)
+        if(std::find(all.begin(), all.end(), name) == all.end()){
+            printf("Unknown output field %s\n", name.c_str());
+            ok = false;
+        }
+    if(fields.empty())
+        return ok;
+    for(const std::string &name : all)
+        if(std::find(fields.begin(), fields.end(), name) == fields.end())
+            m.SetFileOption("Tag:" + name, "nosave");
+    return ok;
+}
+
+#endif
@@ -0,0 +1,199 @@
+#ifndef COMMON_POINT_LOCATOR_H
+#define COMMON_POINT_LOCATOR_H
+
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// Point location in a planar mesh of polygons (triangles, quads, ...).
+// Polygons are registered in the buckets of a uniform grid covered by
+// their bounding boxes, about one polygon per bucket on average, so a query
+// tests the few polygons of one bucket. Polygon c has the vertices
+// (px[l], py[l]), l = polyStart[c], ..., polyStart[c+1]-1, in order around it.
+//
+//   PointLocator loc;
+//   loc.build(polyStart, px, py);
+//   int c = loc.locate(x, y);              // -1 outside the mesh
+//   loc.locate(x, y, n, cells);            // n points at once, in parallel
+
+class PointLocator
+{
+public:
+    void build(const std::vector<unsigned> &polyStart_, const std::vector<double> &px_, const std::vector<double> &py_)
+    {
+        polyStart = polyStart_;
+        px = px_;
+        py = py_;
+        unsigned np = numPolygons();
+        x0 = y0 = 1e300;
+        double x1 = -1e300, y1 = -1e300;
+        for(size_t l = 0; l < px.size(); l++){
+            x0 = std::min(x0, px[l]);
+            x1 = std::max(x1, px[l]);
+            y0 = std::min(y0, py[l]);
+            y1 = std::max(y1, py[l]);
+        }
+        // Square-ish buckets, about as many as polygons
+        double w = std::max(x1 - x0, 1e-300), h = std::max(y1 - y0, 1e-300);
+        double cells = std::max(1.0, static_cast<double>(np));
+        nx = std::max(1u, static_cast<unsigned>(sqrt(cells * w / h)));
+        ny = std::max(1u, static_cast<unsigned>(cells / nx));
+        hx = w / nx;
+        hy = h / ny;
+
+        // Counting sort of (bucket, polygon) pairs
+        std::vector<unsigned> box(4 * np);
+        bucketStart.assign(nx * ny + 1, 0);
+        for(unsigned c = 0; c < np; c++){
+            double bx0 = 1e300, bx1 = -1e300, by0 = 1e300, by1 = -1e300;
+            for(unsigned l = polyStart[c]; l < polyStart[c + 1]; l++){
+                bx0 = std::min(bx0, px[l]);
+                bx1 = std::max(bx1, px[l]);
+                by0 = std::min(by0, py[l]);
+                by1 = std::max(by1, py[l]);
+            }
+            unsigned *b = &box[4 * c];
+            b[0] = bucketX(bx0);
+            b[1] = bucketX(bx1);
+            b[2] = bucketY(by0);
+            b[3] = bucketY(by1);
+            for(unsigned j = b[2]; j <= b[3]; j++)
+                for(unsigned i = b[0]; i <= b[1]; i++)
+                    bucketStart[j * nx + i + 1]++;
+        }
+        for(unsigned k = 0; k < nx * ny; k++)
+            bucketStart[k + 1] += bucketStart[k];
+        bucketPolys.resize(bucketStart[nx * ny]);
+        std::vector<unsigned> pos(bucketStart.begin(), bucketStart.end() - 1);
+        for(unsigned c = 0; c < np; c++){
+            const unsigned *b = &box[4 * c];
+            for(unsigned j = b[2]; j <= b[3]; j++)
+                for(unsigned i = b[0]; i <= b[1]; i++)
+                    bucketPolys[pos[j * nx + i]++] = c;
+        }
+    }
+
+    unsigned numPolygons() const { return polyStart.empty() ? 0 : static_cast<unsigned>(polyStart.size() - 1); }
+
+    /// Polygon containing (x, y), -1 if there is none.
+    /// A point on a shared edge goes to one of the polygons.
+    int locate(double x, double y) const
+    {
+        if(polyStart.empty() || x < x0 - tolerance() || y < y0 - tolerance()
+           || x > x0 + nx * hx + tolerance() || y > y0 + ny * hy + tolerance())
+            return -1;
+        unsigned k = bucketY(y) * nx + bucketX(x);
+        for(unsigned l = bucketStart[k]; l < bucketStart[k + 1]; l++)
+            if(contains(bucketPolys[l], x, y))
+                return static_cast<int>(bucketPolys[l]);
+        return -1;
+    }
+
+    /// Containing polygons of the points (x[i], y[i]), i < n, -1 outside.
+    /// Large batches are first counting-sorted by tiles of 8 x 8 buckets, so
+    /// that consecutive queries touch the same polygons (several times
+    /// faster for scattered points); queries then run in parallel.
+    void locate(const double *x, const double *y, unsigned n, int *cells) const
+    {
+        int nn = static_cast<int>(n);
+        if(n < 4096 || polyStart.empty()){
+#pragma omp parallel for schedule(static)
+            for(int i = 0; i < nn; i++)
+                cells[i] = locate(x[i], y[i]);
+            return;
+        }
+        unsigned tilesX = (nx + 7) / 8, tilesY = (ny + 7) / 8;
+        std::vector<unsigned> key(n), tileStart(tilesX * tilesY + 1, 0), order(n);
+        for(unsigned i = 0; i < n; i++){
+            key[i] = bucketY(y[i]) / 8 * tilesX + bucketX(x[i]) / 8;
+            tileStart[key[i] + 1]++;
+        }
+        for(unsigned t = 0; t < tilesX * tilesY; t++)
+            tileStart[t + 1] += tileStart[t];
+        for(unsigned i = 0; i < n; i++)
+            order[tileStart[key[i]]++] = i;
+#pragma omp parallel for schedule(static)
+        for(int q = 0; q < nn; q++){
+            unsigned i = order[q];
+            cells[i] = locate(x[i], y[i]);
+        }
+    }
+
+    /// Bounding box of all polygons
+    void bounds(double &xmin, double &ymin, double &xmax, double &ymax) const
+    {
+        xmin = x0;
+        ymin = y0;
+        xmax = x0 + nx * hx;
+        ymax = y0 + ny * hy;
+    }
+
+    /// Whether (x, y) lies in polygon c or on its boundary (within a
+    /// relative tolerance); uses the winding number, so any simple polygon works
+    bool contains(unsigned c, double x, double y) const
+    {
+        int winding = 0;
+        double eps = tolerance();
+        unsigned first = polyStart[c], last = polyStart[c + 1];
+        for(unsigned l = first; l < last; l++){
+            unsigned m = l + 1 < last ? l + 1 : first;
+            double ax = px[l], ay = py[l], bx = px[m], by = py[m];
+            // Signed area of (a, b, p): > 0 if p is left of a->b
+            double cross = (bx - ax) * (y - ay) - (x - ax) * (by - ay);
+            double len2 = (bx - ax) * (bx - ax) + (by - ay) * (by - ay);
+            // On the edge
+            if(cross * cross <= eps * eps * len2
+               && x >= std::min(ax, bx) - eps && x <= std::max(ax, bx) + eps
+               && y >= std::min(ay, by) - eps && y <= std::max(ay, by) + eps)
+                return true;
+            if(ay <= y){
+                if(by > y && cross > 0.0)
+                    winding++;
+            }
+            else if(by <= y && cross < 0.0)
+                winding--;
+        }
+        return winding != 0;
+    }
+
+private:
+    std::vector<unsigned> polyStart;
+    std::vector<double> px, py;
+    /// Grid of nx x ny buckets of size hx x hy from (x0, y0)
+    double x0 = 0.0, y0 = 0.0, hx = 1.0, hy = 1.0;
+    unsigned nx = 0, ny = 0;
+    /// Polygons overlapping bucket k: bucketPolys[bucketStart[k]], ...
+    std::vector<unsigned> bucketStart, bucketPolys;
+
+    double tolerance() const { return 1e-12 * std::max(nx * hx, ny * hy); }
+
+    unsigned bucketX(double x) const
+    {
+        double t = floor((x - x0) / hx);
+        return static_cast<unsigned>(std::min(std::max(t, 0.0), nx - 1.0));
+    }
+    unsigned bucketY(double y) const
+    {
+        double t = floor((y - y0) / hy);
+        return static_cast<unsigned>(std::min(std::max(t, 0.0), ny - 1.0));
+    }
+};
+
+/// n pseudo-random points uniformly in the bounding box of loc, the same
+/// for every run, e.g. as probes for throughput measurements
+inline void random_probe_points(const PointLocator &loc, unsigned n, std::vector<double> &x, std::vector<double> &y)
+{
+    double xmin, ymin, xmax, ymax;
+    loc.bounds(xmin, ymin, xmax, ymax);
+    x.resize(n);
+    y.resize(n);
+    unsigned seed = 2463534242u;
+    for(unsigned i = 0; i < n; i++){
+        seed = seed * 1664525u + 1013904223u;
+        x[i] = xmin + (xmax - xmin) * (seed >> 8) / 16777216.0;
+        seed = seed * 1664525u + 1013904223u;
+        y[i] = ymin + (ymax - ymin) * (seed >> 8) / 16777216.0;
+    }
+}
+
+#endif
@@ -0,0 +1,234 @@
+#ifndef COMMON_PROFILER_H
+#define COMMON_PROFILER_H
+
+#include "memory_usage.h"
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Lightweight phase profiler: scoped wall-clock timers summed per run and
+// phase (calls, total and longest time), with one RSS sample at the end of
+// every run. A scope inside a time loop costs a clock read and a lookup
+// among the phases of the run, not an allocation or a /proc read. The
+// individual events, needed only for the Chrome trace-event file
+// (chrome://tracing, ui.perfetto.dev), are kept after enableTrace().
+//
+//   profiler().enableTrace();          // if writeTrace() will be called
+//   profiler().beginRun(mesh_file);
+//   PROFILE_SCOPE("assembleGlobalSystem");
+//   ...
+//   profiler().writeReport("report.json");
+
+/// String as a JSON string literal, quotes included
+inline std::string json_escape(const std::string &s)
+{
+    std::string out = "\"";
+    for(char c : s){
+        unsigned char u = static_cast<unsigned char>(c);
+        if(c == '"' || c == '\\'){
+            out += '\\';
+            out += c;
+        }
+        else if(u < 0x20){
+            char buf[8];
+            snprintf(buf, sizeof(buf), "\\u%04x", u);
+            out += buf;
+        }
+        else
+            out += c;
+    }
+    return out + "\"";
+}
+
+class Profiler
+{
+public:
+    /// Totals of one phase within a run
+    struct Phase
+    {
+        std::string name;
+        unsigned calls;
+        /// Total and longest duration, seconds
+        double total, longest;
+    };
+
+    /// One solver run: its label (e.g. the mesh file) and phases in order of first appearance
+    struct Run
+    {
+        std::string name;
+        std::vector<Phase> phases;
+        /// End of the run in seconds since the profiler was created and the
+        /// resident set size then (MB), sampled by the next beginRun(); for
+        /// the last run, sampled when a report or trace is written
+        double end, rss;
+        bool ended;
+    };
+
+    /// One finished phase, kept after enableTrace()
+    struct Event
+    {
+        /// Index of the run in getRuns()
+        unsigned run;
+        std::string name;
+        /// Start time and duration in seconds since the profiler was created
+        double start, duration;
+    };
+
+    Profiler() : origin(std::chrono::steady_clock::now()), trace(false) {}
+
+    /// Seconds since the profiler was created
+    double now() const
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - origin).count();
+    }
+
+    /// Keep every event for writeTrace(); memory grows with the number of scopes
+    void enableTrace()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        trace = true;
+    }
+
+    /// Label the following events, one label per solver run
+    void beginRun(const std::string &run)
+    {
+        double t = now(), rss = current_rss_mb();
+        std::lock_guard<std::mutex> lock(mutex);
+        endRun(t, rss);
+        Run r = {run, std::vector<Phase>(), 0.0, 0.0, false};
+        runs.push_back(r);
+    }
+
+    void record(const char *name, double start, double duration)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if(runs.empty()){
+            Run r = {"", std::vector<Phase>(), 0.0, 0.0, false};
+            runs.push_back(r);
+        }
+        std::vector<Phase> &phases = runs.back().phases;
+        size_t i = 0;
+        while(i < phases.size() && phases[i].name != name)
+            i++;
+        if(i == phases.size()){
+            Phase ph = {name, 0, 0.0, 0.0};
+            phases.push_back(ph);
+        }
+        phases[i].calls++;
+        phases[i].total += duration;
+        phases[i].longest = std::max(phases[i].longest, duration);
+        if(trace){
+            Event e = {static_cast<unsigned>(runs.size() - 1), name, start, duration};
+            events.push_back(e);
+        }
+    }
+
+    /// Copy of the runs so far, the current one ended now
+    std::vector<Run> getRuns() const
+    {
+        double t = now(), rss = current_rss_mb();
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<Run> copy = runs;
+        if(!copy.empty() && !copy.back().ended){
+            copy.back().end = t;
+            copy.back().rss = rss;
+            copy.back().ended = true;
+        }
+        return copy;
+    }
+
+    /// Copy of the events recorded since enableTrace()
+    std::vector<Event> getEvents() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return events;
+    }
+
+    /// Per-run, per-phase totals in JSON: calls, total and max time, and the RSS at the end of each run
+    bool writeReport(const std::string &file) const
+    {
+        FILE *f = fopen(file.c_str(), "w");
+        if(!f)
+            return false;
+        std::vector<Run> runs = getRuns();
+        fprintf(f, "{\n  \"wall_s\": %.6f,\n  \"peak_rss_mb\": %.1f,\n  \"runs\": [\n", now(), peak_rss_mb());
+        for(size_t r = 0; r < runs.size(); r++){
+            const std::vector<Phase> &phases = runs[r].phases;
+            fprintf(f, "    {\"run\": %s, \"rss_mb\": %.1f, \"phases\": [\n", json_escape(runs[r].name).c_str(), runs[r].rss);
+            for(size_t i = 0; i < phases.size(); i++)
+                fprintf(f, "      {\"name\": %s, \"calls\": %u, \"total_s\": %.6f, \"max_s\": %.6f}%s\n",
+                        json_escape(phases[i].name).c_str(), phases[i].calls, phases[i].total, phases[i].longest,
+                        i + 1 < phases.size() ? "," : "");
+            fprintf(f, "    ]}%s\n", r + 1 < runs.size() ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+        fclose(f);
+        return true;
+    }
+
+    /// Chrome trace-event JSON: one complete event per phase (after enableTrace())
+    /// and an RSS counter at the end of every run
+    bool writeTrace(const std::string &file) const
+    {
+        FILE *f = fopen(file.c_str(), "w");
+        if(!f)
+            return false;
+        std::vector<Run> runs = getRuns();
+        std::vector<Event> events = getEvents();
+        fprintf(f, "{\"traceEvents\": [\n");
+        for(const Event &e : events)
+            fprintf(f, "  {\"name\": %s, \"ph\": \"X\", \"pid\": 1, \"tid\": 1, \"ts\": %.1f, \"dur\": %.1f, \"args\": {\"run\": %s}},\n",
+                    json_escape(e.name).c_str(), 1e6 * e.start, 1e6 * e.duration, json_escape(runs[e.run].name).c_str());
+        for(size_t r = 0; r < runs.size(); r++)
+            fprintf(f, "  {\"name\": \"RSS\", \"ph\": \"C\", \"pid\": 1, \"ts\": %.1f, \"args\": {\"MB\": %.1f}}%s\n",
+                    1e6 * runs[r].end, runs[r].rss, r + 1 < runs.size() ? "," : "");
+        fprintf(f, "], \"displayTimeUnit\": \"ms\"}\n");
+        fclose(f);
+        return true;
+    }
+
+private:
+    std::chrono::steady_clock::time_point origin;
+    std::vector<Run> runs;
+    std::vector<Event> events;
+    bool trace;
+    mutable std::mutex mutex;
+
+    /// Closes the current run at time t with the given RSS; the caller holds the lock
+    void endRun(double t, double rss)
+    {
+        if(runs.empty() || runs.back().ended)
+            return;
+        runs.back().end = t;
+        runs.back().rss = rss;
+        runs.back().ended = true;
+    }
+};
+
+/// Process-wide profiler
+inline Profiler &profiler()
+{
+    static Profiler p;
+    return p;
+}
+
+/// Records the lifetime of the object as a phase
+class ScopedTimer
+{
+public:
+    explicit ScopedTimer(const char *name_) : name(name_), start(profiler().now()) {}
+    ~ScopedTimer() { profiler().record(name, start, profiler().now() - start); }
+private:
+    const char *name;
+    double start;
+};
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+/// Times the rest of the enclosing scope under the given name
+#define PROFILE_SCOPE(name) ScopedTimer PROFILE_CONCAT(scopedTimer_, __LINE__)(name)
+
+#endif
@@ -0,0 +1,203 @@
+#ifndef COMMON_REORDER_H
+#define COMMON_REORDER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <algorithm>
+
+// Renumbering of unknowns to reduce matrix bandwidth and improve locality.
+// Graphs are given in CSR form: neighbours of vertex v are
+// adj[start[v]], ..., adj[start[v+1]-1]. Orderings are returned as
+// permutations perm[old index] = new index.
+
+/// Ordering of unknowns
+enum Ordering
+{
+    /// Mesh iteration order
+    ORDER_NATIVE = 0,
+    /// Reverse Cuthill-McKee on the matrix graph
+    ORDER_RCM = 1,
+    /// Hilbert space-filling curve through the unknown locations
+    ORDER_HILBERT = 2,
+    /// Morton (Z-order) curve through the unknown locations
+    ORDER_MORTON = 3
+};
+
+/// Parses native|rcm|hilbert|morton, returns false for anything else
+inline bool parse_ordering(const char *name, Ordering &ordering)
+{
+    const char *names[4] = {"native", "rcm", "hilbert", "morton"};
+    for(int i = 0; i < 4; i++){
+        if(!strcmp(name, names[i])){
+            ordering = static_cast<Ordering>(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+/// Breadth-first search from 'root' inside its component: 'visited' gets the
+/// vertices in visiting order and 'level' their distance from root
+/// (level must be -1 for them on entry). Returns the number of levels.
+inline unsigned reorder_bfs(unsigned root, const std::vector<unsigned> &start, const std::vector<unsigned> &adj,
+                            std::vector<int> &level, std::vector<unsigned> &visited)
+{
+    visited.clear();
+    visited.push_back(root);
+    level[root] = 0;
+    for(size_t q = 0; q < visited.size(); q++){
+        unsigned v = visited[q];
+        for(unsigned l = start[v]; l < start[v + 1]; l++){
+            unsigned w = adj[l];
+            if(level[w] < 0){
+                level[w] = level[v] + 1;
+                visited.push_back(w);
+            }
+        }
+    }
+    return static_cast<unsigned>(level[visited.back()]) + 1;
+}
+
+inline void reorder_reset(std::vector<int> &level, const std::vector<unsigned> &visited)
+{
+    for(unsigned v : visited)
+        level[v] = -1;
+}
+
+/// Reverse Cuthill-McKee ordering. Every component starts from a
+/// pseudo-peripheral vertex (George-Liu), neighbours are visited
+/// by increasing degree.
+inline std::vector<unsigned> rcm_ordering(unsigned n, const std::vector<unsigned> &start, const std::vector<unsigned> &adj)
+{
+    std::vector<unsigned> order;
+    order.reserve(n);
+    std::vector<int> level(n, -1);
+    std::vector<char> done(n, 0);
+    std::vector<unsigned> visited, nbrs;
+    auto degree = [&](unsigned v){ return start[v + 1] - start[v]; };
+
+    for(unsigned seed = 0; seed < n; seed++){
+        if(done[seed])
+            continue;
+        // Start from the minimum degree vertex of the component and move to a
+        // minimum degree vertex of the last BFS level while the depth grows
+        unsigned root = seed;
+        reorder_bfs(seed, start, adj, level, visited);
+        for(unsigned v : visited)
+            if(degree(v) < degree(root))
+                root = v;
+        reorder_reset(level, visited);
+        unsigned depth = reorder_bfs(root, start, adj, level, visited);
+        for(int it = 0; it < 8; it++){
+            unsigned cand = visited.back();
+            for(unsigned v : visited)
+                if(level[v] == static_cast<int>(depth) - 1 && degree(v) < degree(cand))
+                    cand = v;
+            reorder_reset(level, visited);
+            unsigned d = reorder_bfs(cand, start, adj, level, visited);
+            if(d <= depth)
+                break;
+            depth = d;
+            root = cand;
+        }
+        reorder_reset(level, visited);
+
+        // Cuthill-McKee from root
+        size_t first = order.size();
+        order.push_back(root);
+        done[root] = 1;
+        for(size_t q = first; q < order.size(); q++){
+            unsigned v = order[q];
+            nbrs.clear();
+            for(unsigned l = start[v]; l < start[v + 1]; l++)
+                if(!done[adj[l]])
+                    nbrs.push_back(adj[l]);
+            std::sort(nbrs.begin(), nbrs.end(), [&](unsigned a, unsigned b){
+                return degree(a) < degree(b) || (degree(a) == degree(b) && a < b);
+            });
+            for(unsigned w : nbrs){
+                if(!done[w]){
+                    done[w] = 1;
+                    order.push_back(w);
+                }
+            }
+        }
+    }
+
+    std::vector<unsigned> perm(n);
+    for(unsigned k = 0; k < n; k++)
+        perm[order[k]] = n - 1 - k;
+    return perm;
+}
+
+/// Index of cell (x, y) of a 2^16 x 2^16 grid along the Hilbert curve
+inline uint64_t hilbert_index(uint32_t x, uint32_t y)
+{
+    uint64_t d = 0;
+    for(uint32_t s = 1u << 15; s > 0; s >>= 1){
+        uint32_t rx = (x & s) ? 1 : 0;
+        uint32_t ry = (y & s) ? 1 : 0;
+        d += static_cast<uint64_t>(s) * s * ((3 * rx) ^ ry);
+        // Rotate the quadrant
+        if(ry == 0){
+            if(rx == 1){
+                x = s - 1 - (x & (s - 1));
+                y = s - 1 - (y & (s - 1));
+            }
+            std::swap(x, y);
+        }
+        x &= s - 1;
+        y &= s - 1;
+    }
+    return d;
+}
+
+/// Index of cell (x, y) of a 2^16 x 2^16 grid along the Morton curve
+inline uint64_t morton_index(uint32_t x, uint32_t y)
+{
+    uint64_t d = 0;
+    for(int b = 15; b >= 0; b--)
+        d = (d << 2) | (((y >> b) & 1u) << 1) | ((x >> b) & 1u);
+    return d;
+}
+
+/// Ordering of points (x[i], y[i]) along a space-filling curve
+inline std::vector<unsigned> curve_ordering(unsigned n, const std::vector<double> &x, const std::vector<double> &y, Ordering curve)
+{
+    double xmin = *std::min_element(x.begin(), x.end()), xmax = *std::max_element(x.begin(), x.end());
+    double ymin = *std::min_element(y.begin(), y.end()), ymax = *std::max_element(y.begin(), y.end());
+    double scale = 65535.0 / std::max(std::max(xmax - xmin, ymax - ymin), 1e-300);
+    std::vector<std::pair<uint64_t, unsigned> > key(n);
+    for(unsigned i = 0; i < n; i++){
+        uint32_t ix = static_cast<uint32_t>((x[i] - xmin) * scale);
+        uint32_t iy = static_cast<uint32_t>((y[i] - ymin) * scale);
+        key[i].first = curve == ORDER_MORTON ? morton_index(ix, iy) : hilbert_index(ix, iy);
+        key[i].second = i;
+    }
+    std::sort(key.begin(), key.end());
+    std::vector<unsigned> perm(n);
+    for(unsigned k = 0; k < n; k++)
+        perm[key[k].second] = k;
+    return perm;
+}
+
+/// Bandwidth max |p(i) - p(j)| and profile sum_i (p(i) - min_j p(j)) of the
+/// matrix with the given graph under permutation p (identity if empty)
+inline void bandwidth_profile(unsigned n, const std::vector<unsigned> &start, const std::vector<unsigned> &adj,
+                              const std::vector<unsigned> &perm, unsigned &bandwidth, unsigned long long &profile)
+{
+    bandwidth = 0;
+    profile = 0;
+    for(unsigned v = 0; v < n; v++){
+        unsigned pv = perm.empty() ? v : perm[v], first = pv;
+        for(unsigned l = start[v]; l < start[v + 1]; l++){
+            unsigned pw = perm.empty() ? adj[l] : perm[adj[l]];
+            bandwidth = std::max(bandwidth, pv > pw ? pv - pw : pw - pv);
+            first = std::min(first, pw);
+        }
+        profile += pv - first;
+    }
+}
+
+#endif
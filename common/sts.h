@@ -0,0 +1,151 @@
+#ifndef COMMON_STS_H
+#define COMMON_STS_H
+
+#include <math.h>
+#include <vector>
+#include <algorithm>
+
+// Explicit super-time-stepping for semi-discrete diffusion problems
+// du/dt = F(u) = M^{-1} (b - K u), M diagonal (lumped mass or cell volumes)
+// and M^{-1} K with real nonnegative eigenvalues up to rho. One step of
+// s stages of the Runge-Kutta-Legendre methods of Meyer, Balsara and
+// Aslam (2014) is stable for
+//   RKL1: dt * rho <= s^2 + s,
+//   RKL2: dt * rho <= (s^2 + s - 2) / 2,
+// i.e. s evaluations of F cover a step about s^2 times longer than forward
+// Euler. Every stage is one operator application and a few vector updates,
+// so there is no linear solve and no global reduction inside a step.
+//
+//   SuperTimeStepper sts;
+//   unsigned s = sts.stagesFor(dt, rho);
+//   sts.step(F, dt, s, u);   // F(y, f) writes f = M^{-1} (b - K y)
+
+/// Explicit scheme
+enum STSScheme
+{
+    /// Implicit time stepping instead
+    STS_NONE = 0,
+    /// First order Runge-Kutta-Legendre
+    STS_RKL1 = 1,
+    /// Second order Runge-Kutta-Legendre
+    STS_RKL2 = 2
+};
+
+/// Largest eigenvalue of the operator J (y = J x) by power iteration from a
+/// fixed pseudo-random vector. J must be similar to a symmetric positive
+/// semidefinite matrix, e.g. M^{-1} K. The estimate approaches rho from below.
+template<class Op>
+double sts_spectral_radius(const Op &J, unsigned n, unsigned iterations = 30)
+{
+    std::vector<double> x(n), y(n);
+    unsigned seed = 12345u;
+    for(unsigned i = 0; i < n; i++){
+        seed = seed * 1664525u + 1013904223u;
+        x[i] = 0.5 + static_cast<double>(seed >> 8) / 16777216.0;
+    }
+    int ni = static_cast<int>(n);
+    double lambda = 0.0;
+    for(unsigned it = 0; it < iterations; it++){
+        double norm = 0.0;
+#pragma omp parallel for simd schedule(static) reduction(+:norm)
+        for(int i = 0; i < ni; i++)
+            norm += x[i] * x[i];
+        norm = sqrt(norm);
+        if(norm == 0.0)
+            break;
+        double scale = 1.0 / norm;
+#pragma omp parallel for simd schedule(static)
+        for(int i = 0; i < ni; i++)
+            x[i] *= scale;
+        J(x.data(), y.data());
+        double ynorm = 0.0;
+#pragma omp parallel for simd schedule(static) reduction(+:ynorm)
+        for(int i = 0; i < ni; i++)
+            ynorm += y[i] * y[i];
+        lambda = sqrt(ynorm);
+        x.swap(y);
+    }
+    return lambda;
+}
+
+class SuperTimeStepper
+{
+public:
+    STSScheme scheme = STS_RKL2;
+    /// Fraction of the stability limit used when choosing the number of stages
+    double safety = 0.9;
+
+    /// Stability limit of dt * rho for s stages
+    double stabilityLimit(unsigned s) const
+    {
+        double ds = static_cast<double>(s);
+        return scheme == STS_RKL1 ? ds * ds + ds : 0.5 * (ds * ds + ds - 2.0);
+    }
+
+    /// Smallest number of stages with dt * rho within safety * stabilityLimit
+    unsigned stagesFor(double dt, double rho) const
+    {
+        double z = dt * rho / safety;
+        // Positive root of the limit, then correct for rounding
+        double root = scheme == STS_RKL1 ? 0.5 * (sqrt(1.0 + 4.0 * z) - 1.0) : 0.5 * (sqrt(9.0 + 8.0 * z) - 1.0);
+        unsigned sMin = scheme == STS_RKL1 ? 1u : 2u;
+        unsigned s = std::max(static_cast<unsigned>(ceil(root)), sMin);
+        while(s > sMin && stabilityLimit(s - 1) >= z)
+            s--;
+        while(stabilityLimit(s) < z)
+            s++;
+        return s;
+    }
+
+    /// One step of s stages: u = u(t + dt). F(y, f) writes f = M^{-1} (b - K y).
+    template<class Rhs>
+    void step(const Rhs &F, double dt, unsigned s, std::vector<double> &u)
+    {
+        int n = static_cast<int>(u.size());
+        yPrev.resize(n);
+        yPrev2.resize(n);
+        y.resize(n);
+        f0.resize(n);
+        fj.resize(n);
+        bool second = scheme == STS_RKL2;
+        double ds = static_cast<double>(s);
+        // b_j of RKL2 (b_0 = b_1 = b_2 = 1/3), all ones for RKL1
+        auto bcoef = [&](unsigned j){
+            if(!second)
+                return 1.0;
+            return j < 2 ? 1.0 / 3.0 : (j * j + j - 2.0) / (2.0 * j * (j + 1.0));
+        };
+        double w1 = second ? 4.0 / (ds * ds + ds - 2.0) : 2.0 / (ds * ds + ds);
+
+        // Y_0 = u, Y_1 = Y_0 + mu~_1 dt F(Y_0)
+        F(u.data(), f0.data());
+        double mt1 = bcoef(1) * w1 * dt;
+#pragma omp parallel for simd schedule(static)
+        for(int i = 0; i < n; i++){
+            yPrev2[i] = u[i];
+            yPrev[i] = u[i] + mt1 * f0[i];
+        }
+        for(unsigned j = 2; j <= s; j++){
+            double dj = static_cast<double>(j);
+            double mu = (2.0 * dj - 1.0) / dj * bcoef(j) / bcoef(j - 1);
+            double nu = -(dj - 1.0) / dj * bcoef(j) / bcoef(j - 2);
+            double mt = mu * w1 * dt;
+            // gamma~_j = -a_{j-1} mu~_j with a_j = 1 - b_j; zero for RKL1
+            double gt = second ? -(1.0 - bcoef(j - 1)) * mt : 0.0;
+            double c0 = 1.0 - mu - nu;
+            F(yPrev.data(), fj.data());
+#pragma omp parallel for simd schedule(static)
+            for(int i = 0; i < n; i++)
+                y[i] = mu * yPrev[i] + nu * yPrev2[i] + c0 * u[i] + mt * fj[i] + gt * f0[i];
+            yPrev2.swap(yPrev);
+            yPrev.swap(y);
+        }
+        u.swap(yPrev);
+    }
+
+private:
+    /// Stages Y_{j-1}, Y_{j-2}, Y_j and F(Y_0), F(Y_{j-1})
+    std::vector<double> yPrev, yPrev2, y, f0, fj;
+};
+
+#endif
@@ -0,0 +1,153 @@
+#ifndef COMMON_TRI_MESH_H
+#define COMMON_TRI_MESH_H
+
+#include "csr_matrix.h"
+#include <stdint.h>
+#include <vector>
+#include <algorithm>
+
+// Flat triangle mesh and its uniform (red) refinement: every triangle is
+// split into 4 by its edge midpoints. Refined meshes are nested, and P1
+// functions of the coarse mesh are exactly represented on the fine one,
+// which gives the intergrid transfer of the geometric multigrid.
+
+struct TriMesh
+{
+    /// Node coordinates
+    std::vector<double> x, y;
+    /// Triangle connectivity: 3 node indices per triangle
+    std::vector<unsigned> tri;
+    /// 1 for nodes on the domain boundary
+    std::vector<char> boundary;
+
+    unsigned numNodes() const { return static_cast<unsigned>(x.size()); }
+    unsigned numTriangles() const { return static_cast<unsigned>(tri.size() / 3); }
+};
+
+/// Bisects the sides of a mesh. Side l joins nodes a and b, given as the
+/// key side[l] = min(a, b) << 32 | max(a, b). The midpoint of every
+/// distinct side is appended to x, y in increasing key order, and mid[l]
+/// is set to it. If given, 'boundary' gets 1 for midpoints of sides of a
+/// single cell, and 'parent' gets the two end nodes of every midpoint.
+/// Shared by refine_red and refine_uniform (mesh_gen.h), so that their
+/// refinements of a triangle mesh number the nodes the same way.
+inline void bisect_sides(const std::vector<uint64_t> &side, std::vector<double> &x, std::vector<double> &y,
+                         std::vector<unsigned> &mid, std::vector<char> *boundary, std::vector<unsigned> *parent)
+{
+    std::vector<std::pair<uint64_t, unsigned> > sorted(side.size());
+    for(size_t l = 0; l < side.size(); l++)
+        sorted[l] = std::make_pair(side[l], static_cast<unsigned>(l));
+    std::sort(sorted.begin(), sorted.end());
+    mid.resize(side.size());
+    for(size_t s = 0; s < sorted.size(); ){
+        size_t e = s;
+        while(e < sorted.size() && sorted[e].first == sorted[s].first)
+            e++;
+        unsigned a = static_cast<unsigned>(sorted[s].first >> 32);
+        unsigned b = static_cast<unsigned>(sorted[s].first & 0xffffffffu);
+        unsigned id = static_cast<unsigned>(x.size());
+        x.push_back(0.5 * (x[a] + x[b]));
+        y.push_back(0.5 * (y[a] + y[b]));
+        if(boundary)
+            boundary->push_back(e - s == 1);
+        if(parent){
+            parent->push_back(a);
+            parent->push_back(b);
+        }
+        for(; s < e; s++)
+            mid[sorted[s].second] = id;
+    }
+}
+
+/// Children of the triangle with nodes v and side midpoints m (m[i] on
+/// side (v[i], v[i+1])): 4 triangles with the orientation of the parent
+inline void red_children(const unsigned *v, const unsigned *m, unsigned children[12])
+{
+    const unsigned c[12] = {v[0], m[0], m[2],
+                            m[0], v[1], m[1],
+                            m[2], m[1], v[2],
+                            m[0], m[1], m[2]};
+    std::copy(c, c + 12, children);
+}
+
+/// Red refinement of 'coarse'. Coarse node v keeps its index in 'fine',
+/// the midpoint of every edge is appended after them. Fine node v is
+/// interpolated from coarse nodes parent[2*v] and parent[2*v+1]
+/// (the same node twice for the coarse vertices). Children of coarse
+/// triangle t are fine triangles 4t, ..., 4t+3 with the same orientation.
+inline void refine_red(const TriMesh &coarse, TriMesh &fine, std::vector<unsigned> &parent)
+{
+    unsigned nv = coarse.numNodes(), nt = coarse.numTriangles();
+    std::vector<uint64_t> side(3 * nt);
+    for(unsigned t = 0; t < nt; t++){
+        for(unsigned i = 0; i < 3; i++){
+            uint64_t a = coarse.tri[3*t + i], b = coarse.tri[3*t + (i + 1) % 3];
+            side[3*t + i] = std::min(a, b) << 32 | std::max(a, b);
+        }
+    }
+    fine.x = coarse.x;
+    fine.y = coarse.y;
+    fine.boundary = coarse.boundary;
+    parent.resize(2 * nv);
+    for(unsigned v = 0; v < nv; v++)
+        parent[2*v] = parent[2*v + 1] = v;
+    std::vector<unsigned> mid;
+    bisect_sides(side, fine.x, fine.y, mid, &fine.boundary, &parent);
+
+    fine.tri.resize(12 * nt);
+    for(unsigned t = 0; t < nt; t++)
+        red_children(&coarse.tri[3*t], &mid[3*t], &fine.tri[12 * t]);
+}
+
+/// Global indices of free (non-boundary) nodes, -1 on the boundary
+inline unsigned number_free_nodes(const TriMesh &T, std::vector<int> &glob)
+{
+    glob.assign(T.numNodes(), -1);
+    int N = 0;
+    for(unsigned v = 0; v < T.numNodes(); v++)
+        if(!T.boundary[v])
+            glob[v] = N++;
+    return static_cast<unsigned>(N);
+}
+
+/// Prolongation from the free nodes of the coarse mesh to the free nodes
+/// of its red refinement: row r of P (r = fineGlob[v]) interpolates the
+/// parents of fine node v. Dirichlet nodes (glob index -1) are dropped,
+/// a correction vanishes there. P has coarseFree columns.
+inline void p1_prolongation(const std::vector<unsigned> &parent, const std::vector<int> &coarseGlob,
+                            const std::vector<int> &fineGlob, unsigned fineFree, CSRMatrix &P)
+{
+    P.n = fineFree;
+    P.rowStart.assign(fineFree + 1, 0);
+    P.col.clear();
+    P.val.clear();
+    std::vector<unsigned> rowNode(fineFree);
+    for(unsigned v = 0; v < fineGlob.size(); v++)
+        if(fineGlob[v] >= 0)
+            rowNode[fineGlob[v]] = v;
+    for(unsigned r = 0; r < fineFree; r++){
+        unsigned v = rowNode[r], a = parent[2*v], b = parent[2*v + 1];
+        int ca = coarseGlob[a], cb = coarseGlob[b];
+        if(a == b){
+            if(ca >= 0){
+                P.col.push_back(static_cast<unsigned>(ca));
+                P.val.push_back(1.0);
+            }
+        }
+        else{
+            if(ca > cb)
+                std::swap(ca, cb);
+            if(ca >= 0){
+                P.col.push_back(static_cast<unsigned>(ca));
+                P.val.push_back(0.5);
+            }
+            if(cb >= 0){
+                P.col.push_back(static_cast<unsigned>(cb));
+                P.val.push_back(0.5);
+            }
+        }
+        P.rowStart[r + 1] = P.nnz();
+    }
+}
+
+#endif
@@ -0,0 +1,95 @@
+#ifndef COMMON_TRI_QUADRATURE_H
+#define COMMON_TRI_QUADRATURE_H
+
+// Symmetric quadrature rules on triangles (Dunavant 1985) as constexpr
+// tables. Points are given by barycentric coordinates, weights sum to 1,
+// so that the integral of f over triangle T is
+//   area(T) * sum_q w_q f(x(eta_q)).
+// All weights are positive.
+
+struct TriQuadPoint
+{
+    double eta[3];
+    double w;
+};
+
+/// Degree 1, the centroid
+constexpr TriQuadPoint TRI_QUAD_1[] = {
+    {{1.0 / 3, 1.0 / 3, 1.0 / 3}, 1.0}
+};
+
+/// Degree 2, 3 points
+constexpr TriQuadPoint TRI_QUAD_2[] = {
+    {{2.0 / 3, 1.0 / 6, 1.0 / 6}, 1.0 / 3},
+    {{1.0 / 6, 2.0 / 3, 1.0 / 6}, 1.0 / 3},
+    {{1.0 / 6, 1.0 / 6, 2.0 / 3}, 1.0 / 3}
+};
+
+/// Degree 4, 6 points
+constexpr TriQuadPoint TRI_QUAD_4[] = {
+    {{0.108103018168070, 0.445948490915965, 0.445948490915965}, 0.223381589678011},
+    {{0.445948490915965, 0.108103018168070, 0.445948490915965}, 0.223381589678011},
+    {{0.445948490915965, 0.445948490915965, 0.108103018168070}, 0.223381589678011},
+    {{0.816847572980459, 0.091576213509771, 0.091576213509771}, 0.109951743655322},
+    {{0.091576213509771, 0.816847572980459, 0.091576213509771}, 0.109951743655322},
+    {{0.091576213509771, 0.091576213509771, 0.816847572980459}, 0.109951743655322}
+};
+
+/// Degree 5, 7 points
+constexpr TriQuadPoint TRI_QUAD_5[] = {
+    {{1.0 / 3, 1.0 / 3, 1.0 / 3}, 0.225},
+    {{0.059715871789770, 0.470142064105115, 0.470142064105115}, 0.132394152788506},
+    {{0.470142064105115, 0.059715871789770, 0.470142064105115}, 0.132394152788506},
+    {{0.470142064105115, 0.470142064105115, 0.059715871789770}, 0.132394152788506},
+    {{0.797426985353087, 0.101286507323456, 0.101286507323456}, 0.125939180544827},
+    {{0.101286507323456, 0.797426985353087, 0.101286507323456}, 0.125939180544827},
+    {{0.101286507323456, 0.101286507323456, 0.797426985353087}, 0.125939180544827}
+};
+
+/// Degree 8, 16 points
+constexpr TriQuadPoint TRI_QUAD_8[] = {
+    {{1.0 / 3, 1.0 / 3, 1.0 / 3}, 0.144315607677787},
+    {{0.081414823414554, 0.459292588292723, 0.459292588292723}, 0.095091634267285},
+    {{0.459292588292723, 0.081414823414554, 0.459292588292723}, 0.095091634267285},
+    {{0.459292588292723, 0.459292588292723, 0.081414823414554}, 0.095091634267285},
+    {{0.658861384496480, 0.170569307751760, 0.170569307751760}, 0.103217370534718},
+    {{0.170569307751760, 0.658861384496480, 0.170569307751760}, 0.103217370534718},
+    {{0.170569307751760, 0.170569307751760, 0.658861384496480}, 0.103217370534718},
+    {{0.898905543365938, 0.050547228317031, 0.050547228317031}, 0.032458497623198},
+    {{0.050547228317031, 0.898905543365938, 0.050547228317031}, 0.032458497623198},
+    {{0.050547228317031, 0.050547228317031, 0.898905543365938}, 0.032458497623198},
+    {{0.008394777409958, 0.263112829634638, 0.728492392955404}, 0.027230314174435},
+    {{0.008394777409958, 0.728492392955404, 0.263112829634638}, 0.027230314174435},
+    {{0.263112829634638, 0.008394777409958, 0.728492392955404}, 0.027230314174435},
+    {{0.263112829634638, 0.728492392955404, 0.008394777409958}, 0.027230314174435},
+    {{0.728492392955404, 0.008394777409958, 0.263112829634638}, 0.027230314174435},
+    {{0.728492392955404, 0.263112829634638, 0.008394777409958}, 0.027230314174435}
+};
+
+struct TriQuadRule
+{
+    /// Polynomials up to this degree are integrated exactly
+    unsigned degree;
+    unsigned size;
+    const TriQuadPoint *points;
+};
+
+constexpr TriQuadRule TRI_QUAD_RULES[] = {
+    {1, 1, TRI_QUAD_1},
+    {2, 3, TRI_QUAD_2},
+    {4, 6, TRI_QUAD_4},
+    {5, 7, TRI_QUAD_5},
+    {8, 16, TRI_QUAD_8}
+};
+
+/// Rule of the lowest available degree >= 'degree', the highest one beyond that
+inline const TriQuadRule &tri_quadrature(unsigned degree)
+{
+    const unsigned numRules = sizeof(TRI_QUAD_RULES) / sizeof(TRI_QUAD_RULES[0]);
+    for(unsigned r = 0; r < numRules; r++)
+        if(TRI_QUAD_RULES[r].degree >= degree)
+            return TRI_QUAD_RULES[r];
+    return TRI_QUAD_RULES[numRules - 1];
+}
+
+#endif
@@ -0,0 +1,312 @@
+#ifndef COMMON_VTK_READER_H
+#define COMMON_VTK_READER_H
+
+#include "csr_io.h"
+#include "mesh_gen.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <string>
+#include <vector>
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// Reader for 2D legacy ASCII VTK unstructured grids (the task1/meshes and
+// task2/data files) into a PolyMesh. The file is memory-mapped; the
+// POINTS, CELLS and CELL_TYPES sections are cut into chunks at whitespace,
+// and the chunks are tokenized and parsed in parallel: one pass counts
+// the numbers of each chunk, the second parses them straight into place.
+// Only polygons are kept (triangles, quads, pixels, polygons); vertices
+// and lines, as written by Gmsh for the boundary, are skipped, and so are
+// the nodes that no polygon uses. Cells are turned counterclockwise.
+//
+//   PolyMesh M;
+//   if(read_vtk("unit_square3.vtk", M))
+//       poly_to_mesh(M, m);
+
+/// Number from [p, e): Clinger's fast path when the decimal mantissa and
+/// the power of ten are exact doubles (all numbers Gmsh and the solvers
+/// write), otherwise strtod. Both round correctly.
+inline bool vtk_parse_double(const char *p, const char *e, double &v)
+{
+    static const double pow10[23] = {1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+                                     1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+    const char *s = p;
+    bool negative = false;
+    if(s < e && (*s == '-' || *s == '+'))
+        negative = *s++ == '-';
+    uint64_t mantissa = 0;
+    int digits = 0, exp10 = 0;
+    bool any = false;
+    for(; s < e && *s >= '0' && *s <= '9'; s++, any = true){
+        if(digits < 19){
+            mantissa = 10 * mantissa + (*s - '0');
+            digits += mantissa > 0;
+        }
+        else
+            exp10++;
+    }
+    if(s < e && *s == '.'){
+        for(s++; s < e && *s >= '0' && *s <= '9'; s++, any = true){
+            if(digits < 19){
+                mantissa = 10 * mantissa + (*s - '0');
+                digits += mantissa > 0;
+                exp10--;
+            }
+        }
+    }
+    if(any && s < e && (*s == 'e' || *s == 'E')){
+        const char *t = s + 1;
+        bool negExp = false;
+        if(t < e && (*t == '-' || *t == '+'))
+            negExp = *t++ == '-';
+        int x = 0;
+        bool expDigits = false;
+        for(; t < e && *t >= '0' && *t <= '9'; t++, expDigits = true)
+            x = std::min(10 * x + (*t - '0'), 100000);
+        if(expDigits){
+            exp10 += negExp ? -x : x;
+            s = t;
+        }
+    }
+    if(any && s == e && mantissa < (uint64_t(1) << 53) && exp10 >= -22 && exp10 <= 22){
+        double m = static_cast<double>(mantissa);
+        v = exp10 < 0 ? m / pow10[-exp10] : m * pow10[exp10];
+        if(negative)
+            v = -v;
+        return true;
+    }
+    // Long mantissas, large exponents, inf, nan
+    char buf[64];
+    size_t len = static_cast<size_t>(e - p);
+    if(len >= sizeof(buf))
+        return false;
+    memcpy(buf, p, len);
+    buf[len] = 0;
+    char *stop;
+    v = strtod(buf, &stop);
+    return stop == buf + len;
+}
+
+inline bool vtk_parse_int(const char *p, const char *e, int &v)
+{
+    bool negative = false;
+    if(p < e && (*p == '-' || *p == '+'))
+        negative = *p++ == '-';
+    if(p == e)
+        return false;
+    long long x = 0;
+    for(; p < e; p++){
+        if(*p < '0' || *p > '9' || x > 0x7fffffffLL)
+            return false;
+        x = 10 * x + (*p - '0');
+    }
+    v = static_cast<int>(negative ? -x : x);
+    return true;
+}
+
+inline bool vtk_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t' || c == '\f' || c == '\v';
+}
+
+/// Parses the whitespace-separated tokens of [begin, end) into out[0..count)
+/// in parallel; false if a token does not parse or there are not exactly
+/// 'count' of them
+template<class T, class Parse>
+bool vtk_parse_tokens(const char *begin, const char *end, size_t count, T *out, Parse parse)
+{
+    // Chunks of at least 64 KB, a few per thread for balance
+    int numChunks = 1;
+#ifdef _OPENMP
+    numChunks = 4 * omp_get_max_threads();
+#endif
+    numChunks = static_cast<int>(std::max<ptrdiff_t>(1, std::min<ptrdiff_t>(numChunks, (end - begin) >> 16)));
+    std::vector<const char *> cut(numChunks + 1);
+    for(int c = 0; c <= numChunks; c++){
+        const char *p = begin + (end - begin) * static_cast<ptrdiff_t>(c) / numChunks;
+        while(p < end && !vtk_space(*p))
+            p++;
+        cut[c] = p;
+    }
+    cut[0] = begin;
+
+    std::vector<size_t> first(numChunks + 1, 0);
+#pragma omp parallel for schedule(dynamic)
+    for(int c = 0; c < numChunks; c++){
+        size_t tokens = 0;
+        for(const char *p = cut[c], *e = cut[c + 1]; p < e; ){
+            while(p < e && vtk_space(*p))
+                p++;
+            if(p == e)
+                break;
+            tokens++;
+            while(p < e && !vtk_space(*p))
+                p++;
+        }
+        first[c + 1] = tokens;
+    }
+    for(int c = 0; c < numChunks; c++)
+        first[c + 1] += first[c];
+    if(first[numChunks] != count)
+        return false;
+
+    int bad = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:bad)
+    for(int c = 0; c < numChunks; c++){
+        T *o = out + first[c];
+        for(const char *p = cut[c], *e = cut[c + 1]; p < e; ){
+            while(p < e && vtk_space(*p))
+                p++;
+            if(p == e)
+                break;
+            const char *t = p;
+            while(p < e && !vtk_space(*p))
+                p++;
+            if(!parse(t, p, *o++))
+                bad++;
+        }
+    }
+    return bad == 0;
+}
+
+/// Sequential tokenizer for the section headers
+struct VTKCursor
+{
+    const char *p, *end;
+
+    std::string token()
+    {
+        while(p < end && vtk_space(*p))
+            p++;
+        const char *t = p;
+        while(p < end && !vtk_space(*p))
+            p++;
+        return std::string(t, p);
+    }
+
+    void skipLine()
+    {
+        while(p < end && *p != '\n')
+            p++;
+        if(p < end)
+            p++;
+    }
+
+    /// Start of the next whitespace-delimited 'word' from p, end if there is none
+    const char *find(const char *word) const
+    {
+        size_t len = strlen(word);
+        for(const char *q = p; q + len <= end; q++){
+            q = std::search(q, end, word, word + len);
+            if(q == end)
+                break;
+            if((q == p || vtk_space(q[-1])) && (q + len == end || vtk_space(q[len])))
+                return q;
+        }
+        return end;
+    }
+};
+
+/// VTK cell types that are polygons
+enum VTKCellType
+{
+    VTK_TRIANGLE = 5,
+    VTK_POLYGON = 7,
+    VTK_PIXEL = 8,
+    VTK_QUAD = 9
+};
+
+/// Reads a 2D ASCII VTK unstructured grid; false if the file cannot be
+/// mapped, is not of that form, or has 3D cells
+inline bool read_vtk(const std::string &file, PolyMesh &M)
+{
+    MappedFile map;
+    if(!map.open(file))
+        return false;
+    VTKCursor in = {map.data, map.data + map.size};
+    // Version line and title
+    in.skipLine();
+    in.skipLine();
+    if(in.token() != "ASCII" || in.token() != "DATASET" || in.token() != "UNSTRUCTURED_GRID")
+        return false;
+
+    if(in.token() != "POINTS")
+        return false;
+    int numPoints = atoi(in.token().c_str());
+    in.token();
+    const char *pointsEnd = in.find("CELLS");
+    std::vector<double> xyz(3 * static_cast<size_t>(std::max(numPoints, 0)));
+    if(numPoints <= 0 || !vtk_parse_tokens(in.p, pointsEnd, xyz.size(), xyz.data(), vtk_parse_double))
+        return false;
+    in.p = pointsEnd;
+
+    if(in.token() != "CELLS")
+        return false;
+    int numCells = atoi(in.token().c_str()), size = atoi(in.token().c_str());
+    const char *cellsEnd = in.find("CELL_TYPES");
+    std::vector<int> conn(static_cast<size_t>(std::max(size, 0))), types(static_cast<size_t>(std::max(numCells, 0)));
+    if(numCells <= 0 || !vtk_parse_tokens(in.p, cellsEnd, conn.size(), conn.data(), vtk_parse_int))
+        return false;
+    in.p = cellsEnd;
+
+    if(in.token() != "CELL_TYPES" || atoi(in.token().c_str()) != numCells)
+        return false;
+    const char *typesEnd = std::min(in.find("CELL_DATA"), in.find("POINT_DATA"));
+    if(!vtk_parse_tokens(in.p, typesEnd, types.size(), types.data(), vtk_parse_int))
+        return false;
+
+    // Polygons, nodes renumbered in file order over the used ones
+    std::vector<int> index(numPoints, -1);
+    M.cellStart.assign(1, 0);
+    M.cellNodes.clear();
+    M.cellNodes.reserve(conn.size());
+    size_t pos = 0;
+    for(int c = 0; c < numCells; c++){
+        if(pos >= conn.size() || conn[pos] < 0 || pos + 1 + conn[pos] > conn.size())
+            return false;
+        int k = conn[pos];
+        const int *v = &conn[pos + 1];
+        pos += 1 + k;
+        int t = types[c];
+        if(t < VTK_TRIANGLE)
+            continue;
+        if(t > VTK_QUAD || k < 3 || (t == VTK_TRIANGLE && k != 3) || (t != VTK_POLYGON && t != VTK_TRIANGLE && k != 4))
+            return false;
+        size_t first = M.cellNodes.size();
+        for(int i = 0; i < k; i++){
+            // Pixels are numbered like the lexicographic corners
+            int node = v[t == VTK_PIXEL && i >= 2 ? 5 - i : i];
+            if(node < 0 || node >= numPoints)
+                return false;
+            M.cellNodes.push_back(static_cast<unsigned>(node));
+        }
+        double area2 = 0.0;
+        for(int i = 0; i < k; i++){
+            unsigned a = M.cellNodes[first + i], b = M.cellNodes[first + (i + 1) % k];
+            area2 += xyz[3 * a] * xyz[3 * b + 1] - xyz[3 * b] * xyz[3 * a + 1];
+        }
+        if(area2 < 0.0)
+            std::reverse(M.cellNodes.begin() + first, M.cellNodes.end());
+        M.cellStart.push_back(static_cast<unsigned>(M.cellNodes.size()));
+        for(size_t l = first; l < M.cellNodes.size(); l++)
+            index[M.cellNodes[l]] = 0;
+    }
+    M.x.clear();
+    M.y.clear();
+    for(int v = 0; v < numPoints; v++){
+        if(index[v] < 0)
+            continue;
+        index[v] = static_cast<int>(M.x.size());
+        M.x.push_back(xyz[3 * v]);
+        M.y.push_back(xyz[3 * v + 1]);
+    }
+    for(size_t l = 0; l < M.cellNodes.size(); l++)
+        M.cellNodes[l] = static_cast<unsigned>(index[M.cellNodes[l]]);
+    return M.numCells() > 0;
+}
+
+#endif
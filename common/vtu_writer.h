@@ -0,0 +1,354 @@
+#ifndef COMMON_VTU_WRITER_H
+#define COMMON_VTU_WRITER_H
+
+#include "inmost.h"
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <algorithm>
+#ifdef USE_ZLIB
+#include <zlib.h>
+#endif
+
+// XML VTK unstructured grid (.vtu) output with all arrays in one appended
+// block, raw binary or base64, optionally zlib-compressed in 32 KB blocks
+// (vtkZLibDataCompressor, built with USE_ZLIB). Output goes through a
+// snapshot: the selected fields are copied out of the mesh on the calling
+// thread, and a VTUWriter encodes and writes the copy on a background
+// thread while the caller moves on to the next time step or mesh.
+//
+//   VTUWriter writer;
+//   writer.compress = true;
+//   VTUData data;
+//   vtu_snapshot(m, {"Concentration"}, data);
+//   writer.write("res.vtu", data);   // returns at once
+//   ...
+//   writer.wait();
+
+enum VTUEncoding
+{
+    VTU_RAW = 0,
+    VTU_BASE64 = 1
+};
+
+/// VTK cell types written
+const uint8_t VTU_TRIANGLE = 5, VTU_POLYGON = 7, VTU_QUAD = 9;
+/// Uncompressed size of a compressed block
+const size_t VTU_BLOCK_SIZE = 32768;
+
+inline bool vtu_compression_available()
+{
+#ifdef USE_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+/// Point or cell data array: real values or 32-bit integers, 'components' per entity
+struct VTUField
+{
+    std::string name;
+    bool onCells = false, integer = false;
+    unsigned components = 1;
+    std::vector<double> real;
+    std::vector<int32_t> ints;
+};
+
+/// Points (x, y, z), cells as node lists with end offsets, and fields
+struct VTUData
+{
+    std::vector<double> points;
+    std::vector<int32_t> connectivity, offsets;
+    std::vector<uint8_t> types;
+    std::vector<VTUField> fields;
+
+    size_t numPoints() const { return points.size() / 3; }
+    size_t numCells() const { return types.size(); }
+};
+
+/// Appends base64 of [data, data + size) to out
+inline void vtu_base64(const unsigned char *data, size_t size, std::string &out)
+{
+    static const char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    size_t start = out.size();
+    out.resize(start + (size + 2) / 3 * 4);
+    char *o = &out[start];
+    size_t i = 0;
+    for(; i + 3 <= size; i += 3, o += 4){
+        uint32_t w = uint32_t(data[i]) << 16 | uint32_t(data[i + 1]) << 8 | data[i + 2];
+        o[0] = digits[w >> 18];
+        o[1] = digits[w >> 12 & 63];
+        o[2] = digits[w >> 6 & 63];
+        o[3] = digits[w & 63];
+    }
+    if(i < size){
+        uint32_t w = uint32_t(data[i]) << 16 | (i + 1 < size ? uint32_t(data[i + 1]) << 8 : 0);
+        o[0] = digits[w >> 18];
+        o[1] = digits[w >> 12 & 63];
+        o[2] = i + 1 < size ? digits[w >> 6 & 63] : '=';
+        o[3] = '=';
+    }
+}
+
+/// Appended data block, arrays added one by one at recorded offsets.
+/// Every array is preceded by a UInt64 header: its byte count, or for
+/// compressed data [#blocks, block size, last block size (0 if full),
+/// compressed size of every block]. In base64 an uncompressed header is
+/// encoded together with its array, a compressed header separately.
+class VTUAppendedData
+{
+public:
+    VTUAppendedData(VTUEncoding encoding_, bool compress_) : encoding(encoding_), compress(compress_) {}
+
+    /// Adds an array, returns its offset or -1 if compression failed
+    long long add(const void *data, size_t bytes)
+    {
+        long long offset = static_cast<long long>(out.size());
+        const unsigned char *src = static_cast<const unsigned char *>(data);
+        if(!compress){
+            std::vector<unsigned char> block(sizeof(uint64_t) + bytes);
+            uint64_t size = bytes;
+            memcpy(&block[0], &size, sizeof(size));
+            if(bytes > 0)
+                memcpy(&block[sizeof(size)], src, bytes);
+            put(block.data(), block.size());
+            return offset;
+        }
+#ifdef USE_ZLIB
+        size_t numBlocks = (bytes + VTU_BLOCK_SIZE - 1) / VTU_BLOCK_SIZE;
+        std::vector<uint64_t> header(3 + numBlocks);
+        header[0] = numBlocks;
+        header[1] = VTU_BLOCK_SIZE;
+        header[2] = bytes % VTU_BLOCK_SIZE;
+        std::vector<unsigned char> packed;
+        std::vector<unsigned char> z(compressBound(VTU_BLOCK_SIZE));
+        for(size_t b = 0; b < numBlocks; b++){
+            size_t size = std::min(VTU_BLOCK_SIZE, bytes - b * VTU_BLOCK_SIZE);
+            uLongf zsize = static_cast<uLongf>(z.size());
+            if(compress2(z.data(), &zsize, src + b * VTU_BLOCK_SIZE, static_cast<uLong>(size), Z_DEFAULT_COMPRESSION) != Z_OK)
+                return -1;
+            header[3 + b] = zsize;
+            packed.insert(packed.end(), z.begin(), z.begin() + zsize);
+        }
+        put(reinterpret_cast<const unsigned char *>(header.data()), header.size() * sizeof(uint64_t));
+        put(packed.data(), packed.size());
+        return offset;
+#else
+        return -1;
+#endif
+    }
+
+    const std::string &data() const { return out; }
+
+private:
+    VTUEncoding encoding;
+    bool compress;
+    std::string out;
+
+    void put(const unsigned char *p, size_t size)
+    {
+        if(encoding == VTU_BASE64)
+            vtu_base64(p, size, out);
+        else
+            out.append(reinterpret_cast<const char *>(p), size);
+    }
+};
+
+/// Writes d to 'file'; *bytes is the file size. False if the file cannot
+/// be written or compression is requested without USE_ZLIB.
+inline bool write_vtu(const std::string &file, const VTUData &d, VTUEncoding encoding, bool compress, size_t *bytes = NULL)
+{
+    VTUAppendedData app(encoding, compress);
+    std::string xml;
+    char buf[512];
+    auto array = [&](const char *type, const std::string &name, unsigned components, const void *data, size_t size){
+        long long offset = app.add(data, size);
+        snprintf(buf, sizeof(buf), "        <DataArray type=\"%s\" Name=\"%s\" NumberOfComponents=\"%u\" format=\"appended\" offset=\"%lld\"/>\n",
+                 type, name.c_str(), components, offset);
+        xml += buf;
+        return offset >= 0;
+    };
+    bool ok = true;
+    snprintf(buf, sizeof(buf), "    <Piece NumberOfPoints=\"%zu\" NumberOfCells=\"%zu\">\n", d.numPoints(), d.numCells());
+    xml += buf;
+    for(int onCells = 0; onCells < 2; onCells++){
+        xml += onCells ? "      <CellData>\n" : "      <PointData>\n";
+        for(const VTUField &f : d.fields){
+            if(f.onCells != (onCells == 1))
+                continue;
+            if(f.integer)
+                ok = array("Int32", f.name, f.components, f.ints.data(), f.ints.size() * sizeof(int32_t)) && ok;
+            else
+                ok = array("Float64", f.name, f.components, f.real.data(), f.real.size() * sizeof(double)) && ok;
+        }
+        xml += onCells ? "      </CellData>\n" : "      </PointData>\n";
+    }
+    xml += "      <Points>\n";
+    ok = array("Float64", "Points", 3, d.points.data(), d.points.size() * sizeof(double)) && ok;
+    xml += "      </Points>\n      <Cells>\n";
+    ok = array("Int32", "connectivity", 1, d.connectivity.data(), d.connectivity.size() * sizeof(int32_t)) && ok;
+    ok = array("Int32", "offsets", 1, d.offsets.data(), d.offsets.size() * sizeof(int32_t)) && ok;
+    ok = array("UInt8", "types", 1, d.types.data(), d.types.size()) && ok;
+    xml += "      </Cells>\n    </Piece>\n";
+    if(!ok)
+        return false;
+
+    FILE *out = fopen(file.c_str(), "wb");
+    if(!out)
+        return false;
+    fprintf(out, "<?xml version=\"1.0\"?>\n"
+                 "<VTKFile type=\"UnstructuredGrid\" version=\"1.0\" byte_order=\"LittleEndian\" header_type=\"UInt64\"%s>\n"
+                 "  <UnstructuredGrid>\n",
+            compress ? " compressor=\"vtkZLibDataCompressor\"" : "");
+    fwrite(xml.data(), 1, xml.size(), out);
+    fprintf(out, "  </UnstructuredGrid>\n  <AppendedData encoding=\"%s\">\n   _", encoding == VTU_BASE64 ? "base64" : "raw");
+    ok = fwrite(app.data().data(), 1, app.data().size(), out) == app.data().size();
+    fprintf(out, "\n  </AppendedData>\n</VTKFile>\n");
+    if(bytes)
+        *bytes = static_cast<size_t>(ftell(out));
+    return fclose(out) == 0 && ok;
+}
+
+/// Names of a comma-separated list
+inline std::vector<std::string> vtu_field_list(const char *list)
+{
+    std::vector<std::string> names;
+    for(const char *p = list; *p; ){
+        const char *e = strchr(p, ',');
+        if(!e)
+            e = p + strlen(p);
+        if(e > p)
+            names.push_back(std::string(p, e));
+        p = *e ? e + 1 : e;
+    }
+    return names;
+}
+
+/// Copies the nodes, cells and the named NODE or CELL tags of m (real or
+/// integer, fixed size) into d. Sparse tags are 0 where they have no data.
+/// Returns false if a name is not such a tag; the others are still copied.
+inline bool vtu_snapshot(INMOST::Mesh &m, const std::vector<std::string> &names, VTUData &d)
+{
+    using namespace INMOST;
+    d = VTUData();
+    std::vector<int32_t> index(m.NodeLastLocalID(), -1);
+    d.points.reserve(3 * static_cast<size_t>(m.NumberOfNodes()));
+    for(Mesh::iteratorNode inode = m.BeginNode(); inode != m.EndNode(); inode++){
+        Node n = inode->getAsNode();
+        index[n.LocalID()] = static_cast<int32_t>(d.points.size() / 3);
+        d.points.push_back(n.Coords()[0]);
+        d.points.push_back(n.Coords()[1]);
+        d.points.push_back(m.GetDimensions() > 2 ? n.Coords()[2] : 0.0);
+    }
+    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
+        ElementArray<Node> nodes = icell->getNodes();
+        for(unsigned i = 0; i < nodes.size(); i++)
+            d.connectivity.push_back(index[nodes[i].LocalID()]);
+        d.offsets.push_back(static_cast<int32_t>(d.connectivity.size()));
+        d.types.push_back(nodes.size() == 3 ? VTU_TRIANGLE : nodes.size() == 4 ? VTU_QUAD : VTU_POLYGON);
+    }
+
+    bool ok = true;
+    for(const std::string &name : names){
+        Tag tag = m.HaveTag(name) ? m.GetTag(name) : Tag();
+        ElementType type = tag.isValid() && tag.isDefined(CELL) ? CELL : tag.isValid() && tag.isDefined(NODE) ? NODE : NONE;
+        if(type == NONE || tag.GetSize() == ENUMUNDEF
+           || (tag.GetDataType() != DATA_REAL && tag.GetDataType() != DATA_INTEGER)){
+            ok = false;
+            continue;
+        }
+        d.fields.push_back(VTUField());
+        VTUField &f = d.fields.back();
+        f.name = name;
+        f.onCells = type == CELL;
+        f.integer = tag.GetDataType() == DATA_INTEGER;
+        f.components = tag.GetSize();
+        bool sparse = tag.isSparse(type);
+        auto copy = [&](const Element &e){
+            for(unsigned k = 0; k < f.components; k++){
+                bool have = !sparse || e.HaveData(tag);
+                if(f.integer)
+                    f.ints.push_back(have ? e.IntegerArray(tag)[k] : 0);
+                else
+                    f.real.push_back(have ? e.RealArray(tag)[k] : 0.0);
+            }
+        };
+        if(f.onCells)
+            for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++)
+                copy(*icell);
+        else
+            for(Mesh::iteratorNode inode = m.BeginNode(); inode != m.EndNode(); inode++)
+                copy(*inode);
+    }
+    return ok;
+}
+
+/// Background writer: write() hands a snapshot to a worker thread and
+/// returns; it first waits for the previous file, so at most one snapshot
+/// is in flight besides the one being filled.
+class VTUWriter
+{
+public:
+    VTUEncoding encoding = VTU_RAW;
+    bool compress = false;
+
+    /// Files, bytes and background seconds of the completed writes, and the
+    /// time the calling thread spent waiting for them
+    unsigned files = 0;
+    double bytes = 0.0, writeSeconds = 0.0, waitSeconds = 0.0;
+
+    VTUWriter() {}
+    ~VTUWriter() { wait(); }
+
+    /// Takes over the contents of 'data'
+    void write(const std::string &file, VTUData &data)
+    {
+        wait();
+        pending = std::move(data);
+        data = VTUData();
+        // Settings as of this call, the caller may change them meanwhile
+        VTUEncoding enc = encoding;
+        bool z = compress;
+        worker = std::thread([this, file, enc, z](){
+            std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+            size_t size = 0;
+            lastOk = write_vtu(file, pending, enc, z, &size);
+            if(!lastOk)
+                printf("Cannot write %s\n", file.c_str());
+            lastBytes = static_cast<double>(size);
+            lastSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        });
+    }
+
+    /// Waits for the write in flight; false if it failed
+    bool wait()
+    {
+        if(!worker.joinable())
+            return true;
+        std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+        worker.join();
+        waitSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+        pending = VTUData();
+        files += lastOk;
+        bytes += lastBytes;
+        writeSeconds += lastSeconds;
+        return lastOk;
+    }
+
+private:
+    std::thread worker;
+    VTUData pending;
+    bool lastOk = true;
+    double lastBytes = 0.0, lastSeconds = 0.0;
+
+    VTUWriter(const VTUWriter &);
+    VTUWriter &operator=(const VTUWriter &);
+};
+
+#endif
@@ -1,81 +1,25 @@
-#include "inmost.h"
+#include "diffusion_fem.h"
+#include "csr_io.h"
+#include "krylov.h"
+#include "memory_usage.h"
+#include "profiler.h"
+#include "tri_quadrature.h"
+#include "multigrid.h"
 #include <stdio.h>
-
+#include <algorithm>
+#include <thread>
+#include <memory>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace INMOST;
 using namespace std;
 
-// // Corresponds to tensor
-// // [ 1  0 ]
-// // [ 0 10 ]
-// // rotated by M_PI/6
-// const double Dxx = 3.25;
-// const double Dyy = -0.433013;
-// const double Dxy = 0.25;
-
-const double dx = 5.0;
-const double dy = 1.0;
-const double dxy = 0.0;
-const double pi = 3.1415926535898;
-const double a = 4;
-
-double C(double x, double y)
-{
-	return sin(a*x) * sin(a*y);
-}
-
-double source(double x, double y)
-{
-	return (dx + dy) * a * a * sin(a*x) * sin(a*y);
-}
-
-// Class including everything needed
-class Problem
-{
-private:
-	/// Mesh
-	Mesh &m;
-	// =========== Tags =============
-	/// Solution tag: 1 real value per node
-	Tag tagConc;
-	/// Diffusion tensor tag: 3 real values (Dx, Dy, Dxy) per cell
-	Tag tagD;
-	/// Boundary condition value tag: 1 real value per node, sparse on nodes
-	Tag tagBCval;
-	/// Right-hand side tag: 1 real value per node, sparse on nodes
-	Tag tagSource;
-	/// Analytical solution tag: 1 real value per node
-	Tag tagConcAn;
-	/// Global index tag: 1 integer value per node
-	Tag tagGlobInd;
-
-	// =========== Tag names ===========
-	const string tagNameConc = "Concentration";
-	const string tagNameD = "Diffusion_tensor";
-	const string tagNameBCtype = "BC_type";
-	const string tagNameBCval = "BC_value";
-	const string tagNameSource = "Source";
-	const string tagNameConcAn = "Concentration_analytical";
-	const string tagNameGlobInd = "Global_Index";
-
-	// =========== Markers
-	/// Marker for Dirichlet nodes
-	MarkerType mrkDirNode;
-	/// Number of Dirichlet nodes
-	unsigned numDirNodes;
-public:
-	Problem(Mesh &m_);
-	~Problem();
-	void initProblem();
-	void assembleGlobalSystem(Sparse::Matrix &A, Sparse::Vector &rhs);
-	void assembleLocalSystem(const Cell &c, rMatrix &A_loc, rMatrix &rhs_loc);
-	void run();
-    double get_c_norm();
-    double get_L2_norm();
-    double linear_approx_tri(double x, double y, const Cell&);
-};
-
-Problem::Problem(Mesh &m_) : m(m_)
+namespace fem
+{
+
+Problem::Problem(Mesh &m_) : m(m_), withMass(false), ordering(ORDER_NATIVE), solverType(SOLVER_INMOST), mgRefinements(0), haveNorms(false)
 {
 }
 
@@ -86,6 +30,7 @@ Problem::~Problem()
 
 void Problem::initProblem()
 {
+	PROFILE_SCOPE("initProblem");
 	// Init tags
 	tagConc = m.CreateTag(tagNameConc, DATA_REAL, NODE, NONE, 1);
 	tagD = m.CreateTag(tagNameD, DATA_REAL, CELL, NONE, 3);
@@ -136,314 +81,1019 @@ void Problem::initProblem()
 		}
 	}
 	printf("Number of Dirichlet nodes: %d\n", numDirNodes);
+
+	buildGeometryCache();
 }
 
-double basis_func(const Cell &c, const Node &n, double x_, double y_)
+void Problem::buildGeometryCache()
 {
-    ElementArray<Node> nodes = c.getNodes();
-	unsigned n_ind = 0;
-	double x[3];
-	double y[3];
-	for(unsigned i = 0; i < 3; i++){
-		if(n == nodes[i])
-			n_ind = i;
-		double coords[3];
-		nodes[i].Centroid(coords);
-		x[i] = coords[0];
-		y[i] = coords[1];
-	}
-	
-	if(n_ind == 0){
-		return ((x_ - x[2])*(y[1] - y[2]) - (x[1] - x[2])*(y_ - y[2])) /
-			   ((x[0] - x[2])*(y[1] - y[2]) - (x[1] - x[2])*(y[0] - y[2]));
+	numNodeSlots = static_cast<unsigned>(m.NodeLastLocalID());
+	numCells = static_cast<unsigned>(m.NumberOfCells());
+	stiffness.n = static_cast<unsigned>(m.NumberOfNodes()) - numDirNodes;
+
+	nodeX.assign(numNodeSlots, 0.0);
+	nodeY.assign(numNodeSlots, 0.0);
+	nodeGlobInd.assign(numNodeSlots, -1);
+	nodeBCval.assign(numNodeSlots, 0.0);
+	nodeConc.assign(numNodeSlots, 0.0);
+	for(Mesh::iteratorNode inode = m.BeginNode(); inode != m.EndNode(); inode++){
+		Node n = inode->getAsNode();
+		unsigned id = static_cast<unsigned>(n.LocalID());
+		double xn[3];
+		n.Centroid(xn);
+		nodeX[id] = xn[0];
+		nodeY[id] = xn[1];
+		if(n.GetMarker(mrkDirNode))
+			nodeBCval[id] = n.Real(tagBCval);
+		else
+			nodeGlobInd[id] = n.Integer(tagGlobInd);
 	}
-	else if(n_ind == 1){
-		return ((x_ - x[2])*(y[0] - y[2]) - (x[0] - x[2])*(y_ - y[2])) /
-			   ((x[1] - x[2])*(y[0] - y[2]) - (x[0] - x[2])*(y[1] - y[2]));
+
+	cellNodes.resize(3 * numCells);
+	cellArea.resize(numCells);
+	cellGradX.resize(3 * numCells);
+	cellGradY.resize(3 * numCells);
+	cellD.resize(3 * numCells);
+	unsigned k = 0;
+	for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++, k++){
+		Cell c = icell->getAsCell();
+		ElementArray<Node> nodes = c.getNodes();
+		double x[3], y[3];
+		for(unsigned i = 0; i < 3; i++){
+			unsigned id = static_cast<unsigned>(nodes[i].LocalID());
+			cellNodes[3*k + i] = id;
+			x[i] = nodeX[id];
+			y[i] = nodeY[id];
+		}
+		// grad(phi_i) = (y_j - y_l, x_l - x_j) / det, (i,j,l) cyclic,
+		// det = twice the signed area of the triangle
+		double det = (x[1] - x[0])*(y[2] - y[0]) - (x[2] - x[0])*(y[1] - y[0]);
+		for(unsigned i = 0; i < 3; i++){
+			unsigned j = (i + 1) % 3, l = (i + 2) % 3;
+			cellGradX[3*k + i] = (y[j] - y[l]) / det;
+			cellGradY[3*k + i] = (x[l] - x[j]) / det;
+		}
+		cellArea[k] = c.Volume();
+		for(unsigned i = 0; i < 3; i++)
+			cellD[3*k + i] = c.RealArray(tagD)[i];
 	}
-	else if(n_ind == 2){
-		return ((x_ - x[0])*(y[1] - y[0]) - (x[1] - x[0])*(y_ - y[0])) /
-			   ((x[2] - x[0])*(y[1] - y[0]) - (x[1] - x[0])*(y[2] - y[0]));
+
+	if(ordering != ORDER_NATIVE)
+		renumberUnknowns();
+	colorCells();
+}
+
+// Cells adjacent to node id are cells[start[id]], ..., cells[start[id+1]-1]
+void Problem::nodeCellAdjacency(vector<unsigned> &start, vector<unsigned> &cells) const
+{
+	start.assign(numNodeSlots + 1, 0);
+	cells.resize(3 * numCells);
+	for(unsigned k = 0; k < 3 * numCells; k++)
+		start[cellNodes[k] + 1]++;
+	for(unsigned id = 0; id < numNodeSlots; id++)
+		start[id + 1] += start[id];
+	vector<unsigned> pos(start.begin(), start.end() - 1);
+	for(unsigned k = 0; k < numCells; k++)
+		for(unsigned i = 0; i < 3; i++)
+			cells[pos[cellNodes[3*k + i]]++] = k;
+}
+
+// Greedy coloring of cells such that cells sharing a node get different
+// colors, then reordering of the cell arrays color by color.
+// Cells of one color can be assembled concurrently without locks.
+void Problem::colorCells()
+{
+	vector<unsigned> nodeCellStart, nodeCells;
+	nodeCellAdjacency(nodeCellStart, nodeCells);
+
+	// Each cell takes the smallest color not used by its colored neighbours
+	vector<int> color(numCells, -1);
+	// used[c] == k means color c is taken by a neighbour of cell k
+	vector<unsigned> used;
+	unsigned numColors = 0;
+	for(unsigned k = 0; k < numCells; k++){
+		for(unsigned i = 0; i < 3; i++){
+			unsigned id = cellNodes[3*k + i];
+			for(unsigned l = nodeCellStart[id]; l < nodeCellStart[id + 1]; l++){
+				int cl = color[nodeCells[l]];
+				if(cl >= 0)
+					used[cl] = k;
+			}
+		}
+		unsigned c = 0;
+		while(c < numColors && used[c] == k)
+			c++;
+		if(c == numColors){
+			numColors++;
+			used.push_back(numCells);
+		}
+		color[k] = static_cast<int>(c);
 	}
-	else{
-		printf("Unexpected n_ind = %d\n", n_ind);
-		exit(1);
+
+	// Counting sort of cells by color
+	colorStart.assign(numColors + 1, 0);
+	for(unsigned k = 0; k < numCells; k++)
+		colorStart[color[k] + 1]++;
+	for(unsigned c = 0; c < numColors; c++)
+		colorStart[c + 1] += colorStart[c];
+	vector<unsigned> order(numCells);
+	vector<unsigned> pos(colorStart.begin(), colorStart.end() - 1);
+	for(unsigned k = 0; k < numCells; k++)
+		order[pos[color[k]]++] = k;
+
+	vector<unsigned> oldNodes(cellNodes);
+	vector<double> oldArea(cellArea), oldGradX(cellGradX), oldGradY(cellGradY), oldD(cellD);
+	for(unsigned k = 0; k < numCells; k++){
+		unsigned o = order[k];
+		cellArea[k] = oldArea[o];
+		for(unsigned i = 0; i < 3; i++){
+			cellNodes[3*k + i] = oldNodes[3*o + i];
+			cellGradX[3*k + i] = oldGradX[3*o + i];
+			cellGradY[3*k + i] = oldGradY[3*o + i];
+			cellD[3*k + i] = oldD[3*o + i];
+		}
 	}
+	printf("Number of cell colors: %u\n", numColors);
 }
 
-rMatrix basis_func_grad(const Cell &c, const Node &n)
-{
-    ElementArray<Node> nodes = c.getNodes();
-	double x[3];
-	double y[3];
-	// gradient of the basis function
-	rMatrix grad(2,1);
-	unsigned n_ind = 0;
-	for(unsigned i = 0; i < 3; i++){
-		if(n == nodes[i])
-			n_ind = i;
-		double coords[3];
-		nodes[i].Centroid(coords);
-		x[i] = coords[0];
-		y[i] = coords[1];
-	}
-	
-	if(n_ind == 0){
-		grad(0,0) = (y[1] - y[2]);
-		grad(1,0) = - (x[1] - x[2]);
-		grad /= ((x[0] - x[2])*(y[1] - y[2]) - (x[1] - x[2])*(y[0] - y[2]));
-	}
-	else if(n_ind == 1){
-		grad(0,0) = (y[0] - y[2]);
-		grad(1,0) = - (x[0] - x[2]);
-		grad /= ((x[1] - x[2])*(y[0] - y[2]) - (x[0] - x[2])*(y[1] - y[2]));
-	}
-	else if(n_ind == 2){
-		grad(0,0) = (y[1] - y[0]);
-		grad(1,0) = - (x[1] - x[0]);
-		grad /= ((x[2] - x[0])*(y[1] - y[0]) - (x[1] - x[0])*(y[2] - y[0]));
-	
+// Symbolic phase of the assembly: node-to-node CSR pattern on free nodes
+// and the slot of every local matrix entry in it
+// Graph of the matrix on free nodes in global indices: node r is coupled
+// to adj[start[r]], ..., adj[start[r+1]-1] (sorted, including r itself)
+void Problem::freeNodeGraph(vector<unsigned> &start, vector<unsigned> &adj) const
+{
+	unsigned N = stiffness.n;
+	vector<unsigned> nodeCellStart, nodeCells;
+	nodeCellAdjacency(nodeCellStart, nodeCells);
+
+	// Free neighbours of node id (including itself), sorted
+	vector<unsigned> cols;
+	auto collect = [&](unsigned id){
+		cols.clear();
+		for(unsigned l = nodeCellStart[id]; l < nodeCellStart[id + 1]; l++){
+			const unsigned *nodes = &cellNodes[3*nodeCells[l]];
+			for(unsigned j = 0; j < 3; j++)
+				if(nodeGlobInd[nodes[j]] >= 0)
+					cols.push_back(static_cast<unsigned>(nodeGlobInd[nodes[j]]));
+		}
+		sort(cols.begin(), cols.end());
+		cols.erase(unique(cols.begin(), cols.end()), cols.end());
+	};
+
+	start.assign(N + 1, 0);
+	for(unsigned id = 0; id < numNodeSlots; id++){
+		if(nodeGlobInd[id] < 0)
+			continue;
+		collect(id);
+		start[nodeGlobInd[id] + 1] = static_cast<unsigned>(cols.size());
+	}
+	for(unsigned r = 0; r < N; r++)
+		start[r + 1] += start[r];
+	adj.resize(start[N]);
+	for(unsigned id = 0; id < numNodeSlots; id++){
+		if(nodeGlobInd[id] < 0)
+			continue;
+		collect(id);
+		copy(cols.begin(), cols.end(), adj.begin() + start[nodeGlobInd[id]]);
 	}
+}
+
+// Optional renumbering of free nodes: RCM on the node graph or
+// a space-filling curve through node coordinates
+void Problem::renumberUnknowns()
+{
+	PROFILE_SCOPE("renumberUnknowns");
+	unsigned N = stiffness.n;
+	vector<unsigned> start, adj, perm;
+	freeNodeGraph(start, adj);
+	if(ordering == ORDER_RCM)
+		perm = rcm_ordering(N, start, adj);
 	else{
-		printf("Unexpected n_ind = %d\n", n_ind);
-		exit(1);
+		vector<double> x(N), y(N);
+		for(unsigned id = 0; id < numNodeSlots; id++){
+			if(nodeGlobInd[id] >= 0){
+				x[nodeGlobInd[id]] = nodeX[id];
+				y[nodeGlobInd[id]] = nodeY[id];
+			}
+		}
+		perm = curve_ordering(N, x, y, ordering);
+	}
+
+	unsigned bw0, bw1;
+	unsigned long long pr0, pr1;
+	bandwidth_profile(N, start, adj, vector<unsigned>(), bw0, pr0);
+	bandwidth_profile(N, start, adj, perm, bw1, pr1);
+	printf("Renumbering: bandwidth %u -> %u, profile %llu -> %llu\n", bw0, bw1, pr0, pr1);
+
+	for(unsigned id = 0; id < numNodeSlots; id++){
+		if(nodeGlobInd[id] < 0)
+			continue;
+		nodeGlobInd[id] = static_cast<int>(perm[nodeGlobInd[id]]);
+		m.NodeByLocalID(id).Integer(tagGlobInd) = nodeGlobInd[id];
 	}
-	return grad;
-}
-
-void coords_from_barycentric(double *node_x, double *node_y, double *eta, double *x, double *y)
-{
-	*x = node_x[0] * eta[0] + node_x[1] * eta[1] + node_x[2] * eta[2];
-	*y = node_y[0] * eta[0] + node_y[1] * eta[1] + node_y[2] * eta[2];
-}
-
-double Problem::linear_approx_tri(double x, double y, const Cell &c){
-    ElementArray<Node> nodes = c.getNodes();
-    double res = 0.0;
-    for(unsigned i = 0; i < 3; i++){
-        double xn[3];
-        nodes[i].Barycenter(xn);
-        res += nodes[i].Real(tagConc) * basis_func(c, nodes[i], x, y);
-    }
-    return pow(C(x, y) - res, 2);
-}
-
-double integrate_over_triangle(const Cell &c, Problem &p)
-{
-    double res = 0.0;
-    double w3 = 0.205950504760887;
-    double w6 = 0.063691414286223;
-    double eta3[3] = {0.124949503233232, 0.437525248383384, 0.437525248383384};
-    double eta6[3] = {0.797112651860071, 0.165409927389841, 0.037477420750088};
-
-    ElementArray<Node> nodes = c.getNodes();
-    if(nodes.size() != 3){
-        printf("Cell is not a triangle, has %llu nodes!\n", nodes.size());
-        exit(1);
-    }
-    // Coordinates of triangle nodes
-    double node_x[3], node_y[3];
-    // Set them
-    for(unsigned i = 0; i < 3; i++){
-        double c[3];
-        nodes[i].Centroid(c);
-        node_x[i] = c[0];
-        node_y[i] = c[1];
-    }
-
-    // Add contribution from all combinations in eta3
-    double x, y, val;
-    double eta[3];
-    eta[0] = eta3[0];
-    eta[1] = eta3[1];
-    eta[2] = eta3[2];
-    coords_from_barycentric(node_x, node_y, eta, &x, &y);
-    val = p.linear_approx_tri(x, y, c);
-    //printf("x = %e, y = %e, val = %e\n", x, y, val);
-    res += w3 * val;
-    eta[0] = eta3[1];
-    eta[1] = eta3[2];
-    eta[2] = eta3[0];
-    coords_from_barycentric(node_x, node_y, eta, &x, &y);
-    val = p.linear_approx_tri(x, y, c);
-    res += w3 * val;
-    eta[0] = eta3[2];
-    eta[1] = eta3[0];
-    eta[2] = eta3[1];
-    coords_from_barycentric(node_x, node_y, eta, &x, &y);
-    val = p.linear_approx_tri(x, y, c);
-    res += w3 * val;
-
-
-    // Add contribution from all combinations in eta6
-    eta[0] = eta6[0];
-    eta[1] = eta6[1];
-    eta[2] = eta6[2];
-    coords_from_barycentric(node_x, node_y, eta, &x, &y);
-    val = p.linear_approx_tri(x, y, c);
-    res += w6 * val;
-    eta[0] = eta6[0];
-    eta[1] = eta6[2];
-    eta[2] = eta6[1];
-    coords_from_barycentric(node_x, node_y, eta, &x, &y);
-    val = p.linear_approx_tri(x, y, c);
-    res += w6 * val;
-    eta[0] = eta6[1];
-    eta[1] = eta6[0];
-    eta[2] = eta6[2];
-    coords_from_barycentric(node_x, node_y, eta, &x, &y);
-    val = p.linear_approx_tri(x, y, c);
-    res += w6 * val;
-    eta[0] = eta6[1];
-    eta[1] = eta6[2];
-    eta[2] = eta6[0];
-    coords_from_barycentric(node_x, node_y, eta, &x, &y);
-    val = p.linear_approx_tri(x, y, c);
-    res += w6 * val;
-    eta[0] = eta6[2];
-    eta[1] = eta6[0];
-    eta[2] = eta6[1];
-    coords_from_barycentric(node_x, node_y, eta, &x, &y);
-    val = p.linear_approx_tri(x, y, c);
-    res += w6 * val;
-    eta[0] = eta6[2];
-    eta[1] = eta6[1];
-    eta[2] = eta6[0];
-    coords_from_barycentric(node_x, node_y, eta, &x, &y);
-    val = p.linear_approx_tri(x, y, c);
-    res += w6 * val;
-
-    res *= c.Volume();
-    return res;
 }
 
+// Symbolic phase of the assembly: node-to-node CSR pattern on free nodes
+// and the slot of every local matrix entry in it
+void Problem::buildSparsityPattern()
+{
+	unsigned N = stiffness.n;
+	freeNodeGraph(stiffness.rowStart, stiffness.col);
+	stiffness.val.assign(stiffness.rowStart[N], 0.0);
+
+	cellSlot.assign(9 * numCells, -1);
+	for(unsigned k = 0; k < numCells; k++){
+		const unsigned *nodes = &cellNodes[3*k];
+		for(unsigned i = 0; i < 3; i++){
+			int row = nodeGlobInd[nodes[i]];
+			if(row < 0)
+				continue;
+			for(unsigned j = 0; j < 3; j++){
+				int col = nodeGlobInd[nodes[j]];
+				if(col >= 0)
+					cellSlot[9*k + 3*i + j] = stiffness.slot(row, col);
+			}
+		}
+	}
+	printf("Matrix size: %u, nonzeros: %u\n", N, stiffness.nnz());
+}
+
+// Value of the basis function of local node i of cell k at (x_, y_).
+// It is linear, equals 1 at node i and vanishes at the next node j.
+double Problem::basis_func(unsigned k, unsigned i, double x_, double y_) const
+{
+	unsigned j = cellNodes[3*k + (i + 1) % 3];
+	return cellGradX[3*k + i] * (x_ - nodeX[j]) + cellGradY[3*k + i] * (y_ - nodeY[j]);
+}
+
+
 // [ [phi1,phi1], [phi1,phi2]...   ]
 // [   ]
 // [   ]
 // energetic scalar product: [u,v] = (D*grad(u), grad(v)) = (grad(v))^T * D * grad(u)
-void Problem::assembleLocalSystem(const Cell &c, rMatrix &A_loc, rMatrix &rhs_loc)
+// Reference version of local_system_batch, kept for benchmarking
+void Problem::assembleLocalSystem(unsigned k, rMatrix &A_loc, rMatrix &rhs_loc)
 {
      rMatrix D(2,2);
-	 D(0,0) = c.RealArray(tagD)[0];
-	 D(1,1) = c.RealArray(tagD)[1];
-	 D(0,1) = D(1,0) = c.RealArray(tagD)[2];
-	 
-	 ElementArray<Node> nodes = c.getNodes();
-	 
+	 D(0,0) = cellD[3*k + 0];
+	 D(1,1) = cellD[3*k + 1];
+	 D(0,1) = D(1,0) = cellD[3*k + 2];
+
+	 const unsigned *nodes = &cellNodes[3*k];
+	 double area = cellArea[k];
+
 	 A_loc = rMatrix(3,3);
 	 rhs_loc = rMatrix(3,1);
-	 
-	 for(unsigned i = 0; i < 3; i++){
-		double center_x = 0, center_y = 0;
-		for(unsigned j = 0; j < 3; j++){
-			center_x += nodes[j].Coords()[0];
-			center_y += nodes[j].Coords()[1];
-		}
-		center_x /= 3;
-		center_y /= 3;
 
+	 double center_x = (nodeX[nodes[0]] + nodeX[nodes[1]] + nodeX[nodes[2]]) / 3;
+	 double center_y = (nodeY[nodes[0]] + nodeY[nodes[1]] + nodeY[nodes[2]]) / 3;
+
+	 for(unsigned i = 0; i < 3; i++){
+		rMatrix grad_i(2,1);
+		grad_i(0,0) = cellGradX[3*k + i];
+		grad_i(1,0) = cellGradY[3*k + i];
 		for(unsigned j = 0; j < 3; j++){
+			rMatrix grad_j(2,1);
+			grad_j(0,0) = cellGradX[3*k + j];
+			grad_j(1,0) = cellGradY[3*k + j];
 			// Произведение A(i, j) = (D * grad(phi i); grad(phi j)) * Cell_volume
-			A_loc(i, j) = c.Volume() * (basis_func_grad(c, nodes[j]).Transpose() * D * basis_func_grad(c, nodes[i]))(0, 0);
+			A_loc(i, j) = area * (grad_j.Transpose() * D * grad_i)(0, 0);
 		}
-		rhs_loc(i, 0) = c.Volume() * source(center_x, center_y) * basis_func(c, nodes[i], center_x, center_y);
+		rhs_loc(i, 0) = area * source(center_x, center_y) * basis_func(k, i, center_x, center_y);
 	 }
 }
 
-void Problem::assembleGlobalSystem(Sparse::Matrix &A, Sparse::Vector &rhs)
+// Closed-form local system for BATCH triangles at once.
+// Each lane repeats the arithmetic of assembleLocalSystem in the same order,
+// so the results match it within 1 ulp as long as no FMA is contracted
+// (the CMake files build with -ffp-contract=off). The lane loops have fixed
+// length and no branches and are marked omp simd, so they are vectorized
+// (AVX2/AVX-512 when built with USE_NATIVE_ARCH).
+void local_system_batch(LocalBatch &B)
 {
-	// Cell loop
-	// For each cell assemble local system
-	// and incorporate it into global
-	for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
-		Cell c = icell->getAsCell();
-		rMatrix A_loc, rhs_loc;
-		assembleLocalSystem(c, A_loc, rhs_loc);
-		// Now A_loc is 3x3, rhs_loc is 3x1
-		//  
-		//
-		//
-		//
+	double gx[3][BATCH], gy[3][BATCH];
+#pragma omp simd
+	for(unsigned e = 0; e < BATCH; e++){
+		double det = (B.x[1][e] - B.x[0][e])*(B.y[2][e] - B.y[0][e]) - (B.x[2][e] - B.x[0][e])*(B.y[1][e] - B.y[0][e]);
+		gx[0][e] = (B.y[1][e] - B.y[2][e]) / det;
+		gy[0][e] = (B.x[2][e] - B.x[1][e]) / det;
+		gx[1][e] = (B.y[2][e] - B.y[0][e]) / det;
+		gy[1][e] = (B.x[0][e] - B.x[2][e]) / det;
+		gx[2][e] = (B.y[0][e] - B.y[1][e]) / det;
+		gy[2][e] = (B.x[1][e] - B.x[0][e]) / det;
+	}
+	for(unsigned j = 0; j < 3; j++){
+#pragma omp simd
+		for(unsigned e = 0; e < BATCH; e++){
+			// grad(phi j)^T * D
+			double t0 = gx[j][e] * B.D[0][e] + gy[j][e] * B.D[2][e];
+			double t1 = gx[j][e] * B.D[2][e] + gy[j][e] * B.D[1][e];
+			for(unsigned i = 0; i < 3; i++)
+				B.A[3*i + j][e] = B.area[e] * (t0 * gx[i][e] + t1 * gy[i][e]);
+		}
+	}
+#pragma omp simd
+	for(unsigned e = 0; e < BATCH; e++){
+		double center_x = (B.x[0][e] + B.x[1][e] + B.x[2][e]) / 3;
+		double center_y = (B.y[0][e] + B.y[1][e] + B.y[2][e]) / 3;
+		for(unsigned i = 0; i < 3; i++){
+			unsigned j = (i + 1) % 3;
+			double phi = gx[i][e] * (center_x - B.x[j][e]) + gy[i][e] * (center_y - B.y[j][e]);
+			B.b[i][e] = B.area[e] * B.f[e] * phi;
+		}
+	}
+}
 
-		ElementArray<Node> nodes = c.getNodes();
-		unsigned glob_ind[3] = {0,0,0};
-		for(unsigned loc_ind = 0; loc_ind < 3; loc_ind++){
-            // How to determine global index?
-            glob_ind[loc_ind] = nodes[loc_ind].Integer(tagGlobInd);
-			// Tag_Glob_Index
+// Fill the input lanes of B with cells k0, ..., k0 + nb - 1.
+// Unused lanes of the last batch repeat the last cell.
+void Problem::gatherBatch(unsigned k0, unsigned nb, LocalBatch &B) const
+{
+	for(unsigned e = 0; e < BATCH; e++){
+		unsigned k = k0 + min(e, nb - 1);
+		for(unsigned i = 0; i < 3; i++){
+			B.x[i][e] = nodeX[cellNodes[3*k + i]];
+			B.y[i][e] = nodeY[cellNodes[3*k + i]];
+			B.D[i][e] = cellD[3*k + i];
 		}
-		
-		for(unsigned loc_ind = 0; loc_ind < 3; loc_ind++){
-			// Consider node with local index 'loc_ind'
-			
-			// Check if this is a Dirichlet node
-			if(nodes[loc_ind].GetMarker(mrkDirNode))
+		B.area[e] = cellArea[k];
+		double center_x = (B.x[0][e] + B.x[1][e] + B.x[2][e]) / 3;
+		double center_y = (B.y[0][e] + B.y[1][e] + B.y[2][e]) / 3;
+		B.f[e] = source(center_x, center_y);
+	}
+}
+
+/// Stiffness matrix and right-hand side on the free nodes of a flat
+/// triangle mesh, Dirichlet values from the analytical solution, the same
+/// local systems as in Problem. Used for the coarse levels of the
+/// multigrid hierarchy here and in multigrid_fem.
+void assemble_p1(const TriMesh &T, const vector<int> &glob, unsigned N, CSRMatrix &A, vector<double> &rhs)
+{
+	unsigned nt = T.numTriangles();
+
+	// Pattern: free neighbours of every free node, through its triangles
+	vector<unsigned> nodeTriStart(T.numNodes() + 1, 0), nodeTris(3 * nt);
+	for(unsigned k = 0; k < 3 * nt; k++)
+		nodeTriStart[T.tri[k] + 1]++;
+	for(unsigned v = 0; v < T.numNodes(); v++)
+		nodeTriStart[v + 1] += nodeTriStart[v];
+	vector<unsigned> pos(nodeTriStart.begin(), nodeTriStart.end() - 1);
+	for(unsigned k = 0; k < 3 * nt; k++)
+		nodeTris[pos[T.tri[k]]++] = k / 3;
+
+	A.n = N;
+	A.rowStart.assign(N + 1, 0);
+	A.col.clear();
+	vector<unsigned> cols;
+	for(unsigned v = 0; v < T.numNodes(); v++){
+		if(glob[v] < 0)
+			continue;
+		cols.clear();
+		for(unsigned l = nodeTriStart[v]; l < nodeTriStart[v + 1]; l++)
+			for(unsigned j = 0; j < 3; j++)
+				if(glob[T.tri[3*nodeTris[l] + j]] >= 0)
+					cols.push_back(static_cast<unsigned>(glob[T.tri[3*nodeTris[l] + j]]));
+		sort(cols.begin(), cols.end());
+		cols.erase(unique(cols.begin(), cols.end()), cols.end());
+		// Free nodes are numbered in node order, so rows come in order
+		A.col.insert(A.col.end(), cols.begin(), cols.end());
+		A.rowStart[glob[v] + 1] = A.nnz();
+	}
+	A.val.assign(A.nnz(), 0.0);
+	rhs.assign(N, 0.0);
+
+	LocalBatch B;
+	for(unsigned k0 = 0; k0 < nt; k0 += BATCH){
+		unsigned nb = min(BATCH, nt - k0);
+		for(unsigned e = 0; e < BATCH; e++){
+			unsigned k = k0 + min(e, nb - 1);
+			for(unsigned i = 0; i < 3; i++){
+				B.x[i][e] = T.x[T.tri[3*k + i]];
+				B.y[i][e] = T.y[T.tri[3*k + i]];
+			}
+			B.D[0][e] = dx;
+			B.D[1][e] = dy;
+			B.D[2][e] = dxy;
+			B.area[e] = 0.5 * fabs((B.x[1][e] - B.x[0][e])*(B.y[2][e] - B.y[0][e]) - (B.x[2][e] - B.x[0][e])*(B.y[1][e] - B.y[0][e]));
+			B.f[e] = source((B.x[0][e] + B.x[1][e] + B.x[2][e]) / 3, (B.y[0][e] + B.y[1][e] + B.y[2][e]) / 3);
+		}
+		local_system_batch(B);
+		for(unsigned e = 0; e < nb; e++){
+			const unsigned *nodes = &T.tri[3*(k0 + e)];
+			for(unsigned i = 0; i < 3; i++){
+				int row = glob[nodes[i]];
+				if(row < 0)
+					continue;
+				for(unsigned j = 0; j < 3; j++){
+					int col = glob[nodes[j]];
+					if(col < 0)
+						rhs[row] -= B.A[3*i + j][e] * C(T.x[nodes[j]], T.y[nodes[j]]);
+					else
+						A.val[A.slot(row, col)] += B.A[3*i + j][e];
+				}
+				rhs[row] += B.b[i][e];
+			}
+		}
+	}
+}
+
+// Numeric phase of the assembly: refills stiffness.val and rhs, and with
+// withMass set also the mass matrix (P1 local mass area/12 * (1 + delta_ij))
+// and its row sums. Only depends on the pattern built in initProblem(),
+// so it can be repeated after the diffusion tensor changes.
+void Problem::assembleGlobalSystem(Sparse::Vector &rhs)
+{
+	PROFILE_SCOPE("assembleGlobalSystem");
+	// The pattern is only needed by the assembled path
+	if(stiffness.rowStart.empty())
+		buildSparsityPattern();
+	fill(stiffness.val.begin(), stiffness.val.end(), 0.0);
+	for(unsigned r = 0; r < stiffness.n; r++)
+		rhs[r] = 0.0;
+	double *val = stiffness.val.data();
+	double *massVal = NULL, *lumped = NULL;
+	if(withMass){
+		if(mass.rowStart.empty()){
+			mass.n = stiffness.n;
+			mass.rowStart = stiffness.rowStart;
+			mass.col = stiffness.col;
+		}
+		mass.val.assign(stiffness.nnz(), 0.0);
+		lumpedMass.assign(stiffness.n, 0.0);
+		massVal = mass.val.data();
+		lumped = lumpedMass.data();
+	}
+
+	// Cell loop, color by color
+	// For each batch of cells assemble local systems
+	// and scatter them into precomputed slots.
+	// Cells of one color touch disjoint rows, so batches
+	// of the same color are processed in parallel.
+	unsigned numColors = static_cast<unsigned>(colorStart.size()) - 1;
+#pragma omp parallel
+	{
+		LocalBatch B;
+		for(unsigned c = 0; c < numColors; c++){
+			int numBatches = static_cast<int>((colorStart[c + 1] - colorStart[c] + BATCH - 1) / BATCH);
+#pragma omp for schedule(static)
+			for(int ib = 0; ib < numBatches; ib++){
+				unsigned k0 = colorStart[c] + ib * BATCH;
+				unsigned nb = min(BATCH, colorStart[c + 1] - k0);
+				gatherBatch(k0, nb, B);
+				local_system_batch(B);
+				// Now B.A holds 3x3 and B.b holds 3x1 local systems
+
+				for(unsigned e = 0; e < nb; e++){
+					unsigned k = k0 + e;
+					const unsigned *nodes = &cellNodes[3*k];
+					const int *slots = &cellSlot[9*k];
+					for(unsigned loc_ind = 0; loc_ind < 3; loc_ind++){
+						// Consider node with local index 'loc_ind'
+						int row = nodeGlobInd[nodes[loc_ind]];
+
+						// Check if this is a Dirichlet node
+						if(row < 0)
+							continue;
+
+						for(unsigned j = 0; j < 3; j++){
+							int slot = slots[3*loc_ind + j];
+							if(slot < 0)
+								rhs[row] -= B.A[3*loc_ind + j][e] * nodeBCval[nodes[j]];
+							else{
+								val[slot] += B.A[3*loc_ind + j][e];
+								// Dirichlet values do not change in time, their columns drop out
+								if(massVal)
+									massVal[slot] += B.area[e] / 12 * (j == loc_ind ? 2.0 : 1.0);
+							}
+						}
+						rhs[row] += B.b[loc_ind][e];
+						if(lumped)
+							lumped[row] += B.area[e] / 3;
+					}
+				}
+			}
+		}
+	}
+}
+
+// Right-hand side of the system on free nodes without assembling the matrix:
+// load vector minus the contribution of Dirichlet values
+void Problem::assembleRhs(vector<double> &rhs) const
+{
+	PROFILE_SCOPE("assembleRhs");
+	rhs.assign(stiffness.n, 0.0);
+	unsigned numColors = static_cast<unsigned>(colorStart.size()) - 1;
+#pragma omp parallel
+	for(unsigned c = 0; c < numColors; c++){
+#pragma omp for schedule(static)
+		for(int kk = static_cast<int>(colorStart[c]); kk < static_cast<int>(colorStart[c + 1]); kk++){
+			unsigned k = static_cast<unsigned>(kk);
+			const unsigned *nodes = &cellNodes[3*k];
+			const double *gx = &cellGradX[3*k], *gy = &cellGradY[3*k], *D = &cellD[3*k];
+			double center_x = (nodeX[nodes[0]] + nodeX[nodes[1]] + nodeX[nodes[2]]) / 3;
+			double center_y = (nodeY[nodes[0]] + nodeY[nodes[1]] + nodeY[nodes[2]]) / 3;
+			double f = source(center_x, center_y);
+			// D * grad of the Dirichlet lifting
+			double ux = 0.0, uy = 0.0;
+			for(unsigned j = 0; j < 3; j++){
+				if(nodeGlobInd[nodes[j]] < 0){
+					ux += nodeBCval[nodes[j]] * gx[j];
+					uy += nodeBCval[nodes[j]] * gy[j];
+				}
+			}
+			double qx = D[0] * ux + D[2] * uy, qy = D[2] * ux + D[1] * uy;
+			for(unsigned i = 0; i < 3; i++){
+				int row = nodeGlobInd[nodes[i]];
+				if(row < 0)
+					continue;
+				rhs[row] += cellArea[k] * f * basis_func(k, i, center_x, center_y)
+				          - cellArea[k] * (gx[i] * qx + gy[i] * qy);
+			}
+		}
+	}
+}
+
+// Matrix-free stiffness operator on free nodes, y = A x.
+// Per cell: flux q = D * grad(u_h) from the cached gradients,
+// then y_i += area * (grad(phi_i), q). Dirichlet nodes act as zeros.
+void Problem::applyStiffness(const double *x, double *y) const
+{
+	int N = static_cast<int>(stiffness.n);
+	unsigned numColors = static_cast<unsigned>(colorStart.size()) - 1;
+#pragma omp parallel
+	{
+#pragma omp for schedule(static)
+		for(int r = 0; r < N; r++)
+			y[r] = 0.0;
+		for(unsigned c = 0; c < numColors; c++){
+#pragma omp for schedule(static)
+			for(int kk = static_cast<int>(colorStart[c]); kk < static_cast<int>(colorStart[c + 1]); kk++){
+				unsigned k = static_cast<unsigned>(kk);
+				const unsigned *nodes = &cellNodes[3*k];
+				const double *gx = &cellGradX[3*k], *gy = &cellGradY[3*k], *D = &cellD[3*k];
+				int ind[3];
+				double ux = 0.0, uy = 0.0;
+				for(unsigned j = 0; j < 3; j++){
+					ind[j] = nodeGlobInd[nodes[j]];
+					double xj = ind[j] < 0 ? 0.0 : x[ind[j]];
+					ux += xj * gx[j];
+					uy += xj * gy[j];
+				}
+				double qx = cellArea[k] * (D[0] * ux + D[2] * uy);
+				double qy = cellArea[k] * (D[2] * ux + D[1] * uy);
+				for(unsigned i = 0; i < 3; i++)
+					if(ind[i] >= 0)
+						y[ind[i]] += gx[i] * qx + gy[i] * qy;
+			}
+		}
+	}
+}
+
+// Diagonal of the stiffness matrix on free nodes and the Gershgorin bound
+// max_i sum_j |a_ij| / a_ii on the spectrum of D^{-1} A, both cell by cell
+void Problem::stiffnessDiagonal(vector<double> &diag, double &gershgorin) const
+{
+	diag.assign(stiffness.n, 0.0);
+	vector<double> absRowSum(stiffness.n, 0.0);
+	for(unsigned k = 0; k < numCells; k++){
+		const unsigned *nodes = &cellNodes[3*k];
+		const double *gx = &cellGradX[3*k], *gy = &cellGradY[3*k], *D = &cellD[3*k];
+		for(unsigned i = 0; i < 3; i++){
+			int row = nodeGlobInd[nodes[i]];
+			if(row < 0)
 				continue;
-			
+			double qx = D[0] * gx[i] + D[2] * gy[i], qy = D[2] * gx[i] + D[1] * gy[i];
 			for(unsigned j = 0; j < 3; j++){
-				if(nodes[j].GetMarker(mrkDirNode)){
-					rhs[glob_ind[loc_ind]] -= A_loc(loc_ind,j) * nodes[j].Real(tagBCval);
+				if(nodeGlobInd[nodes[j]] < 0)
+					continue;
+				double a_ij = cellArea[k] * (gx[j] * qx + gy[j] * qy);
+				if(i == j)
+					diag[row] += a_ij;
+				absRowSum[row] += fabs(a_ij);
+			}
+		}
+	}
+	gershgorin = 0.0;
+	for(unsigned r = 0; r < stiffness.n; r++)
+		gershgorin = max(gershgorin, absRowSum[r] / diag[r]);
+}
+
+// Matrix-free consistent mass operator on free nodes, y = M x:
+// per cell y_i += area/12 * (x_i + sum_j x_j)
+void Problem::applyMass(const double *x, double *y) const
+{
+	int N = static_cast<int>(stiffness.n);
+	unsigned numColors = static_cast<unsigned>(colorStart.size()) - 1;
+#pragma omp parallel
+	{
+#pragma omp for schedule(static)
+		for(int r = 0; r < N; r++)
+			y[r] = 0.0;
+		for(unsigned c = 0; c < numColors; c++){
+#pragma omp for schedule(static)
+			for(int kk = static_cast<int>(colorStart[c]); kk < static_cast<int>(colorStart[c + 1]); kk++){
+				unsigned k = static_cast<unsigned>(kk);
+				const unsigned *nodes = &cellNodes[3*k];
+				int ind[3];
+				double sum = 0.0;
+				for(unsigned j = 0; j < 3; j++){
+					ind[j] = nodeGlobInd[nodes[j]];
+					if(ind[j] >= 0)
+						sum += x[ind[j]];
 				}
-				else
-					A[glob_ind[loc_ind]][glob_ind[j]] += A_loc(loc_ind,j);
-				
+				double w = cellArea[k] / 12;
+				for(unsigned i = 0; i < 3; i++)
+					if(ind[i] >= 0)
+						y[ind[i]] += w * (x[ind[i]] + sum);
 			}
-			rhs[glob_ind[loc_ind]] += rhs_loc(loc_ind,0);
 		}
 	}
 }
 
+// Lumped mass on free nodes: a third of the area of every adjacent cell
+void Problem::lumpedMassVector(vector<double> &lumped) const
+{
+	lumped.assign(stiffness.n, 0.0);
+	for(unsigned k = 0; k < numCells; k++)
+		for(unsigned i = 0; i < 3; i++)
+			if(nodeGlobInd[cellNodes[3*k + i]] >= 0)
+				lumped[nodeGlobInd[cellNodes[3*k + i]]] += cellArea[k] / 3;
+}
+
+void Problem::setSolver(SolverType type)
+{
+	solverType = type;
+}
+
+// Needed by SOLVER_MG and SOLVER_PCG_MG: the mesh must be 'coarse' after
+// 'refinements' red refinements with poly_to_mesh node order (load_mesh
+// with opt.refine = refinements gives it)
+void Problem::setMultigrid(const TriMesh &coarse, unsigned refinements)
+{
+	mgCoarse = coarse;
+	mgRefinements = refinements;
+}
+
+void Problem::setDumpPrefix(const string &prefix)
+{
+	dumpPrefix = prefix;
+}
+
+void Problem::setOrdering(Ordering ordering_)
+{
+	ordering = ordering_;
+}
+
+// The writer is needed for OUTPUT_VTU only
+void Problem::setOutput(const OutputParams &output_, VTUWriter *writer)
+{
+	output = output_;
+	vtuWriter = writer;
+	if(output.format == OUTPUT_VTU && !vtuWriter)
+		output.format = OUTPUT_VTK;
+	if(output.format == OUTPUT_VTK)
+		output_select_tags(m, {tagNameConc, tagNameD, tagNameBCval, tagNameSource, tagNameConcAn, tagNameGlobInd}, output.fields);
+}
+
+// Writes the tags to <base>.vtk, or hands a snapshot of them to the
+// background writer for <base>.vtu; nothing in OUTPUT_NONE
+void Problem::save(const string &base)
+{
+	if(output.format == OUTPUT_NONE)
+		return;
+	PROFILE_SCOPE("Save");
+	if(output.format == OUTPUT_VTK){
+		m.Save(base + ".vtk");
+		return;
+	}
+	VTUData data;
+	if(!vtu_snapshot(m, output.fields.empty() ? vtuFields : output.fields, data))
+		printf("Some output fields are not node or cell tags, skipped\n");
+	vtuWriter->write(base + ".vtu", data);
+}
+
+// Writes sol as time step 'step' to res_<step>.vtk or .vtu
+void Problem::saveStep(const vector<double> &sol, unsigned step)
+{
+	if(output.format == OUTPUT_NONE)
+		return;
+	storeSolution(sol);
+	char base[64];
+	snprintf(base, sizeof(base), "res_%05u", step);
+	save(base);
+}
+
+// Distance between a and b in units in the last place of a
+static double ulp_diff(double a, double b)
+{
+	if(a == b)
+		return 0.0;
+	double ulp = nextafter(fabs(a), HUGE_VAL) - fabs(a);
+	return fabs(a - b) / ulp;
+}
+
+// Micro-benchmark: rMatrix-based assembleLocalSystem against local_system_batch
+// on all cells of the mesh, plus the largest difference between the two.
+// False if the difference exceeds 1 ulp.
+bool Problem::benchmarkLocalKernel(unsigned repeats)
+{
+	typedef chrono::steady_clock clock;
+	double checksum = 0.0;
+
+	clock::time_point t0 = clock::now();
+	for(unsigned r = 0; r < repeats; r++){
+		for(unsigned k = 0; k < numCells; k++){
+			rMatrix A_loc, rhs_loc;
+			assembleLocalSystem(k, A_loc, rhs_loc);
+			checksum += A_loc(0,0) + rhs_loc(0,0);
+		}
+	}
+	double tRef = chrono::duration<double>(clock::now() - t0).count();
+
+	LocalBatch B;
+	t0 = clock::now();
+	for(unsigned r = 0; r < repeats; r++){
+		for(unsigned k0 = 0; k0 < numCells; k0 += BATCH){
+			gatherBatch(k0, min(BATCH, numCells - k0), B);
+			local_system_batch(B);
+			checksum += B.A[0][0] + B.b[0][0];
+		}
+	}
+	double tBatch = chrono::duration<double>(clock::now() - t0).count();
+
+	double maxUlpA = 0.0, maxUlpB = 0.0;
+	for(unsigned k0 = 0; k0 < numCells; k0 += BATCH){
+		unsigned nb = min(BATCH, numCells - k0);
+		gatherBatch(k0, nb, B);
+		local_system_batch(B);
+		for(unsigned e = 0; e < nb; e++){
+			rMatrix A_loc, rhs_loc;
+			assembleLocalSystem(k0 + e, A_loc, rhs_loc);
+			for(unsigned i = 0; i < 3; i++){
+				for(unsigned j = 0; j < 3; j++)
+					maxUlpA = max(maxUlpA, ulp_diff(A_loc(i,j), B.A[3*i + j][e]));
+				maxUlpB = max(maxUlpB, ulp_diff(rhs_loc(i,0), B.b[i][e]));
+			}
+		}
+	}
+
+	double cells = static_cast<double>(numCells) * repeats;
+	printf("Local kernel benchmark: %u cells x %u repeats (checksum %e)\n", numCells, repeats, checksum);
+	printf("  rMatrix assembleLocalSystem: %8.2f ns/cell\n", 1e9 * tRef / cells);
+	printf("  local_system_batch (x%u):     %8.2f ns/cell, speedup %.1f\n", BATCH, 1e9 * tBatch / cells, tRef / tBatch);
+	printf("  max difference: %g ulp (matrix), %g ulp (rhs)\n", maxUlpA, maxUlpB);
+	if(maxUlpA > 1.0 || maxUlpB > 1.0){
+		printf("local_system_batch differs from the reference by more than 1 ulp (FMA contraction?)\n");
+		return false;
+	}
+	return true;
+}
+
+// C, L2 and H1-seminorm errors of the last solution in one parallel pass
+// over the cached cells. At every point of the quadrature rule of the
+// requested degree, u_h is interpolated from the nodal values with the
+// barycentric coordinates of the point; grad(u_h) is constant per cell.
+// The C error is the nodal maximum.
+ErrorNorms Problem::computeErrorNorms(unsigned quadDegree) const
+{
+	PROFILE_SCOPE("error norms");
+	const TriQuadRule &rule = tri_quadrature(quadDegree);
+	double errC = 0.0, errL2 = 0.0, errH1 = 0.0;
+	int nc = static_cast<int>(numCells);
+#pragma omp parallel for schedule(static) reduction(max:errC) reduction(+:errL2, errH1)
+	for(int kk = 0; kk < nc; kk++){
+		unsigned k = static_cast<unsigned>(kk);
+		const unsigned *nodes = &cellNodes[3*k];
+		double x[3], y[3], u[3], ux = 0.0, uy = 0.0;
+		for(unsigned i = 0; i < 3; i++){
+			x[i] = nodeX[nodes[i]];
+			y[i] = nodeY[nodes[i]];
+			u[i] = nodeConc[nodes[i]];
+			errC = max(errC, fabs(u[i] - C(x[i], y[i])));
+			ux += u[i] * cellGradX[3*k + i];
+			uy += u[i] * cellGradY[3*k + i];
+		}
+		double l2 = 0.0, h1 = 0.0;
+		for(unsigned q = 0; q < rule.size; q++){
+			const double *eta = rule.points[q].eta;
+			double xq = eta[0] * x[0] + eta[1] * x[1] + eta[2] * x[2];
+			double yq = eta[0] * y[0] + eta[1] * y[1] + eta[2] * y[2];
+			double e = C(xq, yq) - (eta[0] * u[0] + eta[1] * u[1] + eta[2] * u[2]);
+			double gx, gy;
+			gradC(xq, yq, gx, gy);
+			l2 += rule.points[q].w * e * e;
+			h1 += rule.points[q].w * ((gx - ux) * (gx - ux) + (gy - uy) * (gy - uy));
+		}
+		errL2 += cellArea[k] * l2;
+		errH1 += cellArea[k] * h1;
+	}
+	ErrorNorms norms;
+	norms.C = errC;
+	norms.L2 = sqrt(errL2);
+	norms.H1 = sqrt(errH1);
+	lastNorms = norms;
+	haveNorms = true;
+	return norms;
+}
+
+// Both getters reuse the last computeErrorNorms() result for the current
+// solution and only run the pass if there is none
 double Problem::get_c_norm() {
-    double normC = 0.0;
-    for(Mesh::iteratorNode inode = m.BeginNode(); inode != m.EndNode(); inode++){
-        Node n = inode->getAsNode();
-        normC = max(fabs(n.Real(tagConc) - C(n.Coords()[0], n.Coords()[1])), normC); // max |C - node.Real(tagConc)|
-    }
-    return normC;
+    return haveNorms ? lastNorms.C : computeErrorNorms().C;
 }
 
 double Problem::get_L2_norm() {
-    double normL2 = 0.0;
-    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
-        Cell c = icell->getAsCell();
-        normL2 += integrate_over_triangle(c, *this);
-    }
-    normL2 = sqrt(normL2);
-    return normL2;
+    return haveNorms ? lastNorms.L2 : computeErrorNorms().L2;
 }
 
-void Problem::run()
+void Problem::solveAssembled(vector<double> &sol)
 {
 	// Matrix size
-	unsigned N = static_cast<unsigned>(m.NumberOfNodes()) - numDirNodes;
+	unsigned N = stiffness.n;
 	// Global matrix called 'stiffness matrix'
 	Sparse::Matrix A;
 	// Solution vector
-	Sparse::Vector sol;
+	Sparse::Vector x;
 	// Right-hand side vector
 	Sparse::Vector rhs;
 
 	A.SetInterval(0, N);
-	sol.SetInterval(0, N);
+	x.SetInterval(0, N);
 	rhs.SetInterval(0, N);
 
-	assembleGlobalSystem(A, rhs);
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	assembleGlobalSystem(rhs);
+	csr_to_sparse(stiffness, A);
+	stats.tAssemble = seconds_since(t0);
 
-	A.Save("A.mtx");
-	rhs.Save("rhs.mtx");
+	// Optional dump of the system in binary CSR, written from copies
+	// on a background thread while the solver runs
+	thread dumpThread;
+	if(!dumpPrefix.empty()){
+		vector<double> b(N);
+		for(unsigned r = 0; r < N; r++)
+			b[r] = rhs[r];
+		string prefix = dumpPrefix;
+		dumpThread = thread([prefix](CSRMatrix A_copy, vector<double> b_copy){
+			PROFILE_SCOPE("Dump system");
+			if(!write_csr_binary(prefix + ".csrb", A_copy) || !write_vector_binary(prefix + ".rhs.vecb", b_copy))
+				printf("Cannot dump the system to %s.csrb\n", prefix.c_str());
+		}, stiffness, move(b));
+	}
 
 	string solver_name = "inner_mptiluc";
 	Solver S(solver_name);
 
-	S.SetMatrix(A);
-	bool solved = S.Solve(rhs, sol);
+	t0 = chrono::steady_clock::now();
+	{
+		PROFILE_SCOPE("SetMatrix");
+		S.SetMatrix(A);
+	}
+	bool solved;
+	{
+		PROFILE_SCOPE("Solve");
+		solved = S.Solve(rhs, x);
+	}
+	stats.tSolve = seconds_since(t0);
+	stats.iterations = static_cast<unsigned>(S.Iterations());
+	if(dumpThread.joinable())
+		dumpThread.join();
+	printf("Number of iterations: %d\n", S.Iterations());
+	printf("Preconditioner time:  %f s\n", S.PreconditionerTime());
+	printf("Iterations time:      %f s\n", S.IterationsTime());
 	if(!solved){
 		printf("Linear solver failed: %s\n", S.GetReason().c_str());
-		printf("Number of iterations: %d\n", S.Iterations());
 		printf("Residual:             %e\n", S.Residual());
 		exit(1);
 	}
+	sol.resize(N);
+	for(unsigned r = 0; r < N; r++)
+		sol[r] = x[r];
+}
+
+void Problem::solveMatrixFree(vector<double> &sol)
+{
+	if(!dumpPrefix.empty())
+		printf("Matrix-free solver: no matrix to dump\n");
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	vector<double> rhs, diag;
+	assembleRhs(rhs);
+	double lmax;
+	stiffnessDiagonal(diag, lmax);
+	stats.tAssemble = seconds_since(t0);
+
+	auto A = [this](const double *x, double *y){ applyStiffness(x, y); };
+	sol.assign(stiffness.n, 0.0);
+	const double rtol = 1e-10, atol = 1e-14;
+	const unsigned maxIter = 100000;
+	KrylovStats kstats;
+	t0 = chrono::steady_clock::now();
+	{
+		PROFILE_SCOPE("Solve");
+		if(solverType == SOLVER_MF_CHEBYSHEV){
+			// Degree-4 polynomial on [lmax/30, lmax]
+			ChebyshevPrec<decltype(A)> M(A, diag, lmax / 30, lmax, 4);
+			kstats = pcg(A, M, rhs, sol, rtol, atol, maxIter);
+		}
+		else{
+			JacobiPrec M(diag);
+			kstats = pcg(A, M, rhs, sol, rtol, atol, maxIter);
+		}
+	}
+	stats.tSolve = seconds_since(t0);
+	stats.iterations = kstats.iterations;
+	printf("Number of iterations: %u\n", kstats.iterations);
+	if(!kstats.converged){
+		printf("Linear solver failed: no convergence\n");
+		printf("Residual:             %e\n", kstats.residual);
+		exit(1);
+	}
+}
+
+// Multigrid over the refinement hierarchy of the mesh: the coarser levels
+// are assembled on flat copies of the red refinements of mgCoarse, the
+// finest level is the stiffness matrix of this problem. The finest mesh
+// has to match the hierarchy node for node.
+void Problem::solveMultigrid(vector<double> &sol, double &operatorMB)
+{
+	if(!dumpPrefix.empty())
+		printf("Multigrid solver: the system is not dumped\n");
+	unsigned N = stiffness.n, L = mgRefinements;
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	vector<TriMesh> meshes(L + 1);
+	vector<vector<int> > glob(L + 1);
+	vector<unsigned> numFree(L + 1);
+	vector<CSRMatrix> A(L), P(L + 1);
+	meshes[0] = mgCoarse;
+	for(unsigned l = 0; l <= L; l++){
+		vector<unsigned> parent;
+		if(l > 0)
+			refine_red(meshes[l - 1], meshes[l], parent);
+		if(l == L){
+			// Free nodes of the problem itself, in its numbering
+			const TriMesh &T = meshes[L];
+			bool match = L > 0 && T.numNodes() == numNodeSlots;
+			for(unsigned v = 0; match && v < T.numNodes(); v++)
+				match = fabs(T.x[v] - nodeX[v]) <= 1e-12 && fabs(T.y[v] - nodeY[v]) <= 1e-12;
+			if(!match){
+				printf("Multigrid: the mesh is not the refined hierarchy, run with --refine k, k > 0\n");
+				exit(1);
+			}
+			glob[L] = nodeGlobInd;
+			numFree[L] = N;
+		}
+		else{
+			vector<double> rhsLevel;
+			numFree[l] = number_free_nodes(meshes[l], glob[l]);
+			assemble_p1(meshes[l], glob[l], numFree[l], A[l], rhsLevel);
+		}
+		if(l > 0)
+			p1_prolongation(parent, glob[l - 1], glob[l], numFree[l], P[l]);
+	}
 
+	Sparse::Vector rhsVec;
+	rhsVec.SetInterval(0, N);
+	assembleGlobalSystem(rhsVec);
+	vector<double> rhs(N);
+	for(unsigned r = 0; r < N; r++)
+		rhs[r] = rhsVec[r];
+	Multigrid mg;
+	for(unsigned l = 0; l < L; l++)
+		mg.addLevel(A[l], P[l]);
+	mg.addLevel(stiffness, P[L]);
+	mg.setup();
+	stats.tAssemble = seconds_since(t0);
+	operatorMB = 0.0;
+	for(unsigned l = 0; l < mg.numLevels(); l++){
+		const CSRMatrix &Al = mg.matrix(l);
+		operatorMB += (4.0 * (Al.n + 1) + 12.0 * Al.nnz() + 12.0 * mg.prolongation(l).nnz()) / 1048576;
+	}
+
+	const double rtol = 1e-10, atol = 1e-14;
+	const unsigned maxIter = 1000;
+	KrylovStats kstats;
+	sol.assign(N, 0.0);
+	t0 = chrono::steady_clock::now();
+	{
+		PROFILE_SCOPE("Solve");
+		if(solverType == SOLVER_PCG_MG){
+			CSROperator op = {&stiffness};
+			kstats = pcg(op, mg, rhs, sol, rtol, atol, maxIter);
+		}
+		else
+			kstats = mg.solve(rhs, sol, rtol, atol, maxIter);
+	}
+	stats.tSolve = seconds_since(t0);
+	stats.iterations = kstats.iterations;
+	printf("Number of iterations: %u (%u levels)\n", kstats.iterations, L + 1);
+	if(!kstats.converged){
+		printf("Linear solver failed: no convergence\n");
+		printf("Residual:             %e\n", kstats.residual);
+		exit(1);
+	}
+}
+
+void Problem::storeSolution(const vector<double> &sol)
+{
 	for(Mesh::iteratorNode inode = m.BeginNode(); inode != m.EndNode(); inode++){
 		Node n = inode->getAsNode();
 		if(n.GetMarker(mrkDirNode)){
@@ -453,26 +1103,373 @@ void Problem::run()
 		unsigned ind = static_cast<unsigned>(n.Integer(tagGlobInd));
 		n.Real(tagConc) = sol[ind];
 	}
-	m.Save("res.vtk");
+	for(unsigned id = 0; id < numNodeSlots; id++)
+		nodeConc[id] = nodeGlobInd[id] < 0 ? nodeBCval[id] : sol[nodeGlobInd[id]];
+	haveNorms = false;
 }
 
-int main(int argc, char ** argv)
+void Problem::run()
 {
-	if( argc < 2 )
-	{
-		printf("Usage: %s mesh_file\n",argv[0]);
-		return -1;
+	stats.dofs = stiffness.n;
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	vector<double> sol;
+	double operatorMB;
+	if(solverType == SOLVER_INMOST){
+		solveAssembled(sol);
+		// CSR copy plus the INMOST matrix (index and value per entry)
+		operatorMB = (4.0 * (stiffness.n + 1) + 12.0 * stiffness.nnz() + 16.0 * stiffness.nnz()) / 1048576;
+	}
+	else if(solverType == SOLVER_MG || solverType == SOLVER_PCG_MG)
+		solveMultigrid(sol, operatorMB);
+	else{
+		solveMatrixFree(sol);
+		// Cached cell data read by applyStiffness
+		operatorMB = (4.0 * numNodeSlots + (12.0 + 8.0 + 48.0 + 24.0) * numCells) / 1048576;
 	}
+	double tSolve = seconds_since(t0);
+	stats.operatorMB = operatorMB;
+	printf("Time to solution: %.3f s, operator storage: %.2f MB, peak RSS: %.1f MB\n",
+		tSolve, operatorMB, peak_rss_mb());
 
-	Mesh m;
-	m.Load(argv[1]);
-	Problem P(m);
-	P.initProblem();
-	P.run();
+	storeSolution(sol);
+	save("res");
+}
+
+// Theta method for M du/dt = -A u + b with the consistent or lumped mass
+// matrix M, started from zero in the free nodes:
+//   (M/dt + theta A) u^{n+1} = (M/dt - (1 - theta) A) u^n + b.
+// A, M and b are assembled once. The step matrix and its preconditioner
+// are rebuilt only when dt changes, every solve starts from u^n.
+void Problem::runTransient(const TransientParams &tp)
+{
+	if(tp.explicitScheme != STS_NONE){
+		runSuperTimeStepping(tp);
+		return;
+	}
+	unsigned N = stiffness.n;
+	int n = static_cast<int>(N);
+	bool assembled = solverType == SOLVER_INMOST;
+	const double rtol = 1e-10, atol = 1e-14, theta = tp.theta;
+	stats.dofs = N;
 
-    cout << "|u - u_approx|_C = "  << P.get_c_norm() << endl;
-    cout << "|u - u_approx|_L2 = " << P.get_L2_norm() << endl;
-	printf("Success\n");
-	// Результат c_norm = O(h) and L_norm = O(h^2)
-	return 0;
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	vector<double> b, diagA;
+	if(assembled){
+		Sparse::Vector rhs;
+		rhs.SetInterval(0, N);
+		withMass = true;
+		assembleGlobalSystem(rhs);
+		b.resize(N);
+		for(unsigned r = 0; r < N; r++)
+			b[r] = rhs[r];
+	}
+	else{
+		// Matrix-free steps use the Jacobi preconditioner of the step matrix
+		assembleRhs(b);
+		double lmax;
+		stiffnessDiagonal(diagA, lmax);
+		lumpedMassVector(lumpedMass);
+	}
+	stats.tAssemble = seconds_since(t0);
+
+	vector<double> w(N);
+	auto applyM = [&](const double *x, double *y){
+		if(tp.lumped){
+#pragma omp parallel for schedule(static)
+			for(int i = 0; i < n; i++)
+				y[i] = lumpedMass[i] * x[i];
+		}
+		else if(assembled)
+			csr_multiply(mass, x, y);
+		else
+			applyMass(x, y);
+	};
+	auto applyA = [&](const double *x, double *y){
+		if(assembled)
+			csr_multiply(stiffness, x, y);
+		else
+			applyStiffness(x, y);
+	};
+	double dt = tp.dt;
+	// y = (M/dt + theta A) x
+	auto applyS = [&](const double *x, double *y){
+		applyA(x, w.data());
+		applyM(x, y);
+#pragma omp parallel for schedule(static)
+		for(int i = 0; i < n; i++)
+			y[i] = y[i] / dt + theta * w[i];
+	};
+
+	// Step matrix and preconditioner, built for dtBuilt
+	CSRMatrix S;
+	Sparse::Matrix SA;
+	Sparse::Vector rhsA, xA;
+	unique_ptr<Solver> solver;
+	JacobiPrec jacobi(vector<double>(N, 1.0));
+	double dtBuilt = -1.0;
+
+	vector<double> u(N, 0.0), x(N), r(N), Mu(N), Au(N, 0.0);
+	unsigned steps = 0, rebuilds = 0, totalIterations = 0;
+	double time = 0.0, tBuild = 0.0, tStepMax = 0.0, change = 0.0;
+	bool steady = false;
+	chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+	while(steps < tp.steps && !steady){
+		t0 = chrono::steady_clock::now();
+		if(dt != dtBuilt){
+			PROFILE_SCOPE("form step matrix");
+			dtBuilt = dt;
+			if(assembled){
+				if(S.rowStart.empty())
+					S = stiffness;
+				for(unsigned l = 0; l < S.nnz(); l++)
+					S.val[l] = theta * stiffness.val[l] + (tp.lumped ? 0.0 : mass.val[l] / dt);
+				if(tp.lumped)
+					for(unsigned i = 0; i < N; i++)
+						S.val[S.slot(i, i)] += lumpedMass[i] / dt;
+				csr_to_sparse(S, SA);
+				if(!solver){
+					solver.reset(new Solver("inner_mptiluc"));
+					rhsA.SetInterval(0, N);
+					xA.SetInterval(0, N);
+				}
+				solver->SetMatrix(SA);
+			}
+			else{
+				// The diagonal of the consistent mass matrix is half the lumped one
+				vector<double> diagS(N);
+				for(unsigned i = 0; i < N; i++)
+					diagS[i] = (tp.lumped ? 1.0 : 0.5) * lumpedMass[i] / dt + theta * diagA[i];
+				jacobi = JacobiPrec(diagS);
+			}
+			tBuild += seconds_since(t0);
+			rebuilds++;
+		}
+
+		// Right-hand side, then the solve warm-started from u^n
+		applyM(u.data(), Mu.data());
+		if(theta < 1.0)
+			applyA(u.data(), Au.data());
+#pragma omp parallel for schedule(static)
+		for(int i = 0; i < n; i++)
+			r[i] = Mu[i] / dt - (1.0 - theta) * Au[i] + b[i];
+		x = u;
+		unsigned iterations;
+		bool converged;
+		{
+			PROFILE_SCOPE("Solve");
+			if(assembled){
+				for(unsigned i = 0; i < N; i++){
+					rhsA[i] = r[i];
+					xA[i] = x[i];
+				}
+				converged = solver->Solve(rhsA, xA);
+				iterations = static_cast<unsigned>(solver->Iterations());
+				for(unsigned i = 0; i < N; i++)
+					x[i] = xA[i];
+			}
+			else{
+				KrylovStats kstats = pcg(applyS, jacobi, r, x, rtol, atol, 100000);
+				converged = kstats.converged;
+				iterations = kstats.iterations;
+			}
+		}
+		if(!converged){
+			printf("Linear solver failed at step %u\n", steps + 1);
+			exit(1);
+		}
+		totalIterations += iterations;
+
+		change = 0.0;
+		double unorm = 0.0;
+		for(unsigned i = 0; i < N; i++){
+			change = max(change, fabs(x[i] - u[i]));
+			unorm = max(unorm, fabs(x[i]));
+		}
+		u.swap(x);
+		time += dt;
+		steps++;
+		steady = tp.steadyTol > 0.0 && change / dt <= tp.steadyTol * unorm;
+		double tStep = seconds_since(t0);
+		tStepMax = max(tStepMax, tStep);
+		if(tp.reportEvery > 0 && (steps % tp.reportEvery == 0 || steady || steps == tp.steps))
+			printf("Step %u: t = %g, dt = %g, iterations %u, step time %.3f ms, max change %e\n",
+				steps, time, dt, iterations, 1e3 * tStep, change);
+		if(tp.outputEvery > 0 && (steps % tp.outputEvery == 0 || steady || steps == tp.steps))
+			saveStep(u, steps);
+		dt = min(dt * tp.dtGrowth, tp.dtMax);
+	}
+	double tTotal = seconds_since(tStart);
+	stats.iterations = totalIterations;
+	stats.tSolve = tTotal;
+
+	if(steady)
+		printf("Steady state reached after %u steps at t = %g\n", steps, time);
+	printf("Time stepping: %u steps to t = %g, %u step matrix builds (%.3f s)\n", steps, time, rebuilds, tBuild);
+	printf("Per step: %.2f iterations, average %.3f ms, max %.3f ms\n",
+		static_cast<double>(totalIterations) / max(steps, 1u), 1e3 * tTotal / max(steps, 1u), 1e3 * tStepMax);
+	printf("Max change in the last step: %e, peak RSS: %.1f MB\n", change, peak_rss_mb());
+
+	storeSolution(u);
+	if(tp.outputEvery == 0)
+		save("res");
+}
+
+// Explicit Runge-Kutta-Legendre super-time-stepping of M_L du/dt = b - A u
+// with the lumped mass M_L and the matrix-free stiffness operator. The
+// spectral radius of M_L^{-1} A is estimated once by power iteration with
+// a 10% margin, capped by the Gershgorin bound, and the number of stages
+// is chosen again whenever dt changes.
+void Problem::runSuperTimeStepping(const TransientParams &tp)
+{
+	unsigned N = stiffness.n;
+	int n = static_cast<int>(N);
+	stats.dofs = N;
+	if(!tp.lumped)
+		printf("Explicit time stepping uses the lumped mass matrix\n");
+
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	vector<double> b, diagA;
+	double gershgorin, bound = 0.0;
+	assembleRhs(b);
+	stiffnessDiagonal(diagA, gershgorin);
+	lumpedMassVector(lumpedMass);
+	// Row sums of |A| are at most gershgorin * a_ii
+	for(unsigned i = 0; i < N; i++)
+		bound = max(bound, gershgorin * diagA[i] / lumpedMass[i]);
+	auto J = [&](const double *x, double *y){
+		applyStiffness(x, y);
+#pragma omp parallel for simd schedule(static)
+		for(int i = 0; i < n; i++)
+			y[i] /= lumpedMass[i];
+	};
+	double rho = min(1.1 * sts_spectral_radius(J, N), bound);
+	stats.tAssemble = seconds_since(t0);
+	printf("Spectral radius of M^-1 A: %e (Gershgorin bound %e), forward Euler dt <= %e\n", rho, bound, 2.0 / rho);
+
+	// F(y) = M_L^{-1} (b - A y)
+	auto F = [&](const double *y, double *f){
+		applyStiffness(y, f);
+#pragma omp parallel for simd schedule(static)
+		for(int i = 0; i < n; i++)
+			f[i] = (b[i] - f[i]) / lumpedMass[i];
+	};
+	SuperTimeStepper sts;
+	sts.scheme = tp.explicitScheme;
+
+	vector<double> u(N, 0.0), uOld(N);
+	unsigned steps = 0, stages = 0, totalStages = 0;
+	double time = 0.0, dt = tp.dt, dtStages = -1.0, tStepMax = 0.0, change = 0.0;
+	bool steady = false;
+	chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+	while(steps < tp.steps && !steady){
+		t0 = chrono::steady_clock::now();
+		if(dt != dtStages){
+			dtStages = dt;
+			stages = sts.stagesFor(dt, rho);
+		}
+		uOld = u;
+		{
+			PROFILE_SCOPE("Super step");
+			sts.step(F, dt, stages, u);
+		}
+		totalStages += stages;
+
+		change = 0.0;
+		double unorm = 0.0;
+		for(unsigned i = 0; i < N; i++){
+			change = max(change, fabs(u[i] - uOld[i]));
+			unorm = max(unorm, fabs(u[i]));
+		}
+		time += dt;
+		steps++;
+		steady = tp.steadyTol > 0.0 && change / dt <= tp.steadyTol * unorm;
+		double tStep = seconds_since(t0);
+		tStepMax = max(tStepMax, tStep);
+		if(tp.reportEvery > 0 && (steps % tp.reportEvery == 0 || steady || steps == tp.steps))
+			printf("Step %u: t = %g, dt = %g, stages %u, step time %.3f ms, max change %e\n",
+				steps, time, dt, stages, 1e3 * tStep, change);
+		if(tp.outputEvery > 0 && (steps % tp.outputEvery == 0 || steady || steps == tp.steps))
+			saveStep(u, steps);
+		dt = min(dt * tp.dtGrowth, tp.dtMax);
+	}
+	double tTotal = seconds_since(tStart);
+	stats.iterations = totalStages;
+	stats.tSolve = tTotal;
+
+	if(steady)
+		printf("Steady state reached after %u steps at t = %g\n", steps, time);
+	printf("Super-time-stepping: %u steps to t = %g, %u operator applications (forward Euler would need %.0f)\n",
+		steps, time, totalStages, ceil(0.5 * rho * time));
+	printf("Per step: %.2f stages, average %.3f ms, max %.3f ms\n",
+		static_cast<double>(totalStages) / max(steps, 1u), 1e3 * tTotal / max(steps, 1u), 1e3 * tStepMax);
+	printf("Max change in the last step: %e, peak RSS: %.1f MB\n", change, peak_rss_mb());
+
+	storeSolution(u);
+	if(tp.outputEvery == 0)
+		save("res");
 }
+
+void Problem::buildLocator()
+{
+	PROFILE_SCOPE("build point locator");
+	vector<unsigned> start(numCells + 1);
+	vector<double> vx(3 * numCells), vy(3 * numCells);
+	for(unsigned k = 0; k <= numCells; k++)
+		start[k] = 3 * k;
+	for(unsigned l = 0; l < 3 * numCells; l++){
+		vx[l] = nodeX[cellNodes[l]];
+		vy[l] = nodeY[cellNodes[l]];
+	}
+	locator.build(start, vx, vy);
+}
+
+// Discrete solution of the last run at the points (px[i], py[i]): P1
+// interpolation through the basis functions of the containing cell,
+// NaN outside the mesh. Points are located and evaluated in parallel.
+void Problem::evaluate(const vector<double> &px, const vector<double> &py, vector<double> &values)
+{
+	if(locator.numPolygons() != numCells)
+		buildLocator();
+	int n = static_cast<int>(px.size());
+	vector<int> cells(n);
+	locator.locate(px.data(), py.data(), static_cast<unsigned>(n), cells.data());
+	values.resize(n);
+#pragma omp parallel for schedule(static)
+	for(int i = 0; i < n; i++){
+		int k = cells[i];
+		if(k < 0){
+			values[i] = NAN;
+			continue;
+		}
+		double v = 0.0;
+		for(unsigned j = 0; j < 3; j++)
+			v += nodeConc[cellNodes[3*k + j]] * basis_func(static_cast<unsigned>(k), j, px[i], py[i]);
+		values[i] = v;
+	}
+}
+
+// Throughput of evaluate() at pseudo-random points of the mesh bounding box,
+// and the largest difference from the analytical solution there
+void Problem::benchmarkProbes(unsigned numProbes)
+{
+	vector<double> px, py, values;
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	buildLocator();
+	double tBuild = seconds_since(t0);
+	random_probe_points(locator, numProbes, px, py);
+	t0 = chrono::steady_clock::now();
+	evaluate(px, py, values);
+	double tEval = seconds_since(t0);
+	double err = 0.0;
+	unsigned outside = 0;
+	for(unsigned i = 0; i < numProbes; i++){
+		if(values[i] != values[i])
+			outside++;
+		else
+			err = max(err, fabs(values[i] - C(px[i], py[i])));
+	}
+	printf("Probes: %u points (%u outside), locator built in %.3f s, %.2f M probes/s, max |u - u_h| = %e\n",
+		numProbes, outside, tBuild, 1e-6 * numProbes / max(tEval, 1e-12), err);
+}
+
+} // namespace fem
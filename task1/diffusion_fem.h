@@ -0,0 +1,311 @@
+#ifndef DIFFUSION_FEM_H
+#define DIFFUSION_FEM_H
+
+#include "inmost.h"
+#include "csr_matrix.h"
+#include "reorder.h"
+#include "sts.h"
+#include "point_locator.h"
+#include "tri_mesh.h"
+#include "output.h"
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// P1 FEM solver of the stationary and transient diffusion problem.
+// Implemented in diffusion_fem.cpp, which is built as the fem_problem
+// library and linked by diffusion_fem, multigrid_fem and convergence_study.
+
+namespace fem
+{
+
+using namespace INMOST;
+using namespace std;
+
+
+// // Corresponds to tensor
+// // [ 1  0 ]
+// // [ 0 10 ]
+// // rotated by M_PI/6
+// const double Dxx = 3.25;
+// const double Dyy = -0.433013;
+// const double Dxy = 0.25;
+
+const double dx = 5.0;
+const double dy = 1.0;
+const double dxy = 0.0;
+const double pi = 3.1415926535898;
+const double a = 4;
+
+inline double C(double x, double y)
+{
+	return sin(a*x) * sin(a*y);
+}
+
+inline double source(double x, double y)
+{
+	return (dx + dy) * a * a * sin(a*x) * sin(a*y);
+}
+
+/// Gradient of the analytical solution C
+inline void gradC(double x, double y, double &gx, double &gy)
+{
+	gx = a * cos(a*x) * sin(a*y);
+	gy = a * sin(a*x) * cos(a*y);
+}
+
+/// Wall time in seconds since t0
+inline double seconds_since(chrono::steady_clock::time_point t0)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+/// Number of triangles processed by one call of the batched local kernel
+const unsigned BATCH = 8;
+
+/// Input and output of local_system_batch, one lane per triangle
+struct LocalBatch
+{
+	/// Node coordinates
+	double x[3][BATCH], y[3][BATCH];
+	/// Diffusion tensor (Dx, Dy, Dxy)
+	double D[3][BATCH];
+	/// Cell area
+	double area[BATCH];
+	/// Source value in the cell center
+	double f[BATCH];
+	/// Local stiffness matrix, row-major
+	double A[9][BATCH];
+	/// Local load vector
+	double b[3][BATCH];
+};
+
+/// Summary of the last run(), used by the convergence study driver
+struct RunStats
+{
+	/// Number of unknowns
+	unsigned dofs;
+	/// Linear solver iterations
+	unsigned iterations;
+	/// Wall time of the assembly (including solver setup input) and of the solve, seconds
+	double tAssemble, tSolve;
+	/// Storage of the operator: assembled matrices or the cell data of the matrix-free one, MB
+	double operatorMB;
+};
+
+/// Errors of the discrete solution against the analytical one
+struct ErrorNorms
+{
+	/// Maximum over the nodes of |u - u_h|
+	double C;
+	/// ||u - u_h||_L2 and the H1 seminorm ||grad(u - u_h)||_L2
+	double L2, H1;
+};
+
+/// How the linear system is solved
+enum SolverType
+{
+	/// Assembled matrix, INMOST inner_mptiluc
+	SOLVER_INMOST = 1,
+	/// Matrix-free operator, CG with Jacobi preconditioner
+	SOLVER_MF_JACOBI = 2,
+	/// Matrix-free operator, CG with Chebyshev polynomial preconditioner
+	SOLVER_MF_CHEBYSHEV = 3,
+	/// Geometric multigrid cycles over the refinement hierarchy of the mesh
+	SOLVER_MG = 4,
+	/// CG preconditioned by one multigrid V-cycle
+	SOLVER_PCG_MG = 5
+};
+
+inline bool parse_solver(const char *name, SolverType &type)
+{
+	if(!strcmp(name, "inmost"))
+		type = SOLVER_INMOST;
+	else if(!strcmp(name, "mf-jacobi"))
+		type = SOLVER_MF_JACOBI;
+	else if(!strcmp(name, "mf-chebyshev"))
+		type = SOLVER_MF_CHEBYSHEV;
+	else if(!strcmp(name, "mg"))
+		type = SOLVER_MG;
+	else if(!strcmp(name, "pcg-mg"))
+		type = SOLVER_PCG_MG;
+	else
+		return false;
+	return true;
+}
+
+/// Settings of runTransient()
+struct TransientParams
+{
+	/// Weight of the new time level: 1 backward Euler, 1/2 Crank-Nicolson
+	double theta = 1.0;
+	/// Diagonal (row-sum lumped) mass matrix instead of the consistent one
+	bool lumped = false;
+	/// Initial time step and maximal number of steps
+	double dt = 1e-3;
+	unsigned steps = 0;
+	/// dt is multiplied by dtGrowth after every step, up to dtMax
+	double dtGrowth = 1.0, dtMax = 1e300;
+	/// Stop when max|u^{n+1} - u^n| / dt <= steadyTol * max|u^{n+1}|, 0 = never
+	double steadyTol = 0.0;
+	/// The solution is saved every outputEvery steps and after the last one, 0 = only after the last one
+	unsigned outputEvery = 0;
+	/// Print the step timings every reportEvery steps, 0 = only the summary
+	unsigned reportEvery = 0;
+	/// Explicit super-time-stepping with the lumped mass instead of the theta method
+	STSScheme explicitScheme = STS_NONE;
+};
+
+// Class including everything needed
+class Problem
+{
+private:
+	/// Mesh
+	Mesh &m;
+	// =========== Tags =============
+	/// Solution tag: 1 real value per node
+	Tag tagConc;
+	/// Diffusion tensor tag: 3 real values (Dx, Dy, Dxy) per cell
+	Tag tagD;
+	/// Boundary condition value tag: 1 real value per node, sparse on nodes
+	Tag tagBCval;
+	/// Right-hand side tag: 1 real value per node, sparse on nodes
+	Tag tagSource;
+	/// Analytical solution tag: 1 real value per node
+	Tag tagConcAn;
+	/// Global index tag: 1 integer value per node
+	Tag tagGlobInd;
+
+	// =========== Tag names ===========
+	const string tagNameConc = "Concentration";
+	const string tagNameD = "Diffusion_tensor";
+	const string tagNameBCtype = "BC_type";
+	const string tagNameBCval = "BC_value";
+	const string tagNameSource = "Source";
+	const string tagNameConcAn = "Concentration_analytical";
+	const string tagNameGlobInd = "Global_Index";
+
+	// =========== Markers
+	/// Marker for Dirichlet nodes
+	MarkerType mrkDirNode;
+	/// Number of Dirichlet nodes
+	unsigned numDirNodes;
+
+	// =========== Geometry cache
+	// Flat copy of everything the cell loops need, built once in initProblem()
+	// so that assembly and integration do not go through INMOST accessors.
+	// Nodes are indexed by LocalID(). Cell arrays are in color order (see
+	// colorCells()), the cells of color c being colorStart[c] .. colorStart[c+1]-1.
+	/// Number of node slots (NodeLastLocalID) and number of cells
+	unsigned numNodeSlots, numCells;
+	/// Node coordinates
+	vector<double> nodeX, nodeY;
+	/// Global index of a node, -1 for Dirichlet nodes
+	vector<int> nodeGlobInd;
+	/// Dirichlet value of a node, 0 for free nodes
+	vector<double> nodeBCval;
+	/// Discrete solution in nodes, filled by run()
+	vector<double> nodeConc;
+	/// Cell connectivity: 3 node indices per cell
+	vector<unsigned> cellNodes;
+	/// Cell areas
+	vector<double> cellArea;
+	/// Basis function gradients: 3 values of d/dx and 3 of d/dy per cell
+	vector<double> cellGradX, cellGradY;
+	/// Diffusion tensor: 3 values (Dx, Dy, Dxy) per cell
+	vector<double> cellD;
+	/// Cells are stored color by color: cells colorStart[c], ..., colorStart[c+1]-1
+	/// have color c, and no two cells of the same color share a node
+	vector<unsigned> colorStart;
+
+	// =========== Sparsity pattern
+	/// Stiffness matrix on free nodes; its pattern is built once in initProblem(),
+	/// assembleGlobalSystem() only refills the values
+	CSRMatrix stiffness;
+	/// Position in stiffness.val of local entry (i,j) of cell k:
+	/// cellSlot[9*k + 3*i + j], -1 if node i or j is a Dirichlet node
+	vector<int> cellSlot;
+	/// Consistent mass matrix with the pattern of the stiffness matrix and
+	/// its row sums, filled by assembleGlobalSystem() if withMass is set
+	CSRMatrix mass;
+	vector<double> lumpedMass;
+	bool withMass;
+
+	/// Cells for evaluate(), built on its first call
+	PointLocator locator;
+	void buildLocator();
+
+	void buildGeometryCache();
+	void nodeCellAdjacency(vector<unsigned> &start, vector<unsigned> &cells) const;
+	void colorCells();
+	void buildSparsityPattern();
+	void freeNodeGraph(vector<unsigned> &start, vector<unsigned> &adj) const;
+	void renumberUnknowns();
+	/// Numbering of free nodes
+	Ordering ordering;
+
+	/// Linear solver used by run()
+	SolverType solverType;
+	/// Multigrid solvers: the mesh is mgCoarse refined mgRefinements times
+	TriMesh mgCoarse;
+	unsigned mgRefinements;
+	/// If not empty, the assembled system is dumped to <dumpPrefix>.csrb and <dumpPrefix>.rhs.vecb
+	string dumpPrefix;
+	/// Output format and fields, and the writer of VTU output
+	OutputParams output;
+	VTUWriter *vtuWriter = nullptr;
+	/// Tags written to .vtu files unless output.fields is set
+	vector<string> vtuFields = {tagNameConc, tagNameConcAn, tagNameSource, tagNameD, tagNameGlobInd, tagNameBCval};
+	void save(const string &base);
+	void saveStep(const vector<double> &sol, unsigned step);
+	void solveAssembled(vector<double> &sol);
+	void solveMatrixFree(vector<double> &sol);
+	void solveMultigrid(vector<double> &sol, double &operatorMB);
+	void storeSolution(const vector<double> &sol);
+	void runSuperTimeStepping(const TransientParams &tp);
+
+	RunStats stats;
+	/// Result of the last computeErrorNorms(), valid until the solution changes
+	mutable ErrorNorms lastNorms;
+	mutable bool haveNorms;
+	double basis_func(unsigned k, unsigned i, double x, double y) const;
+	void gatherBatch(unsigned k0, unsigned nb, LocalBatch &B) const;
+public:
+	Problem(Mesh &m_);
+	~Problem();
+	void initProblem();
+	void assembleGlobalSystem(Sparse::Vector &rhs);
+	void assembleRhs(vector<double> &rhs) const;
+	void applyStiffness(const double *x, double *y) const;
+	void stiffnessDiagonal(vector<double> &diag, double &gershgorin) const;
+	void applyMass(const double *x, double *y) const;
+	void lumpedMassVector(vector<double> &lumped) const;
+	void setSolver(SolverType type);
+	void setMultigrid(const TriMesh &coarse, unsigned refinements);
+	void setDumpPrefix(const string &prefix);
+	void setOrdering(Ordering ordering_);
+	void setOutput(const OutputParams &output_, VTUWriter *writer);
+	const RunStats &getStats() const { return stats; }
+	void assembleLocalSystem(unsigned k, rMatrix &A_loc, rMatrix &rhs_loc);
+	void run();
+	void runTransient(const TransientParams &tp);
+	void evaluate(const vector<double> &px, const vector<double> &py, vector<double> &values);
+	void benchmarkProbes(unsigned numProbes);
+	ErrorNorms computeErrorNorms(unsigned quadDegree = 5) const;
+    double get_c_norm();
+    double get_L2_norm();
+	bool benchmarkLocalKernel(unsigned repeats);
+};
+
+/// Closed-form local systems of the BATCH triangles in B
+void local_system_batch(LocalBatch &B);
+
+/// Stiffness matrix and right-hand side of the problem on the free nodes
+/// of a flat triangle mesh, nodes numbered by glob (-1 for Dirichlet ones)
+void assemble_p1(const TriMesh &T, const vector<int> &glob, unsigned N, CSRMatrix &A, vector<double> &rhs);
+
+} // namespace fem
+
+#endif
@@ -0,0 +1,218 @@
+#include "diffusion_fem.h"
+#include "mesh_load.h"
+#include "memory_usage.h"
+#include "profiler.h"
+#include "tri_quadrature.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace INMOST;
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+	using namespace fem;
+
+	if( argc < 2 )
+	{
+		printf("Usage: %s mesh_file|tri:N [--refine k] [--fast-vtk] [--mesh-cache dir] [--threads N]\n"
+		       "       [--solver inmost|mf-jacobi|mf-chebyshev|mg|pcg-mg] [--bench-kernel] [--profile report.json]\n"
+		       "       [--trace trace.json] [--dump-system prefix]\n"
+		       "       [--format vtk|vtu|none] [--fields name,name,...] [--encoding raw|base64] [--compress]\n"
+		       "       [--ordering native|rcm|hilbert|morton] [--probe N] [--quad-degree d]\n"
+		       "       [--steps n --dt dt [--theta t] [--mass consistent|lumped] [--dt-growth g] [--dt-max dt]\n"
+		       "        [--explicit rkl1|rkl2] [--steady-tol tol] [--report-every k] [--output-every k]]\n",argv[0]);
+		return -1;
+	}
+	bool benchKernel = false;
+	unsigned numProbes = 0, quadDegree = 5;
+	MeshLoadOptions meshOptions;
+	SolverType solverType = SOLVER_INMOST;
+	Ordering ordering = ORDER_NATIVE;
+	string reportFile, traceFile, dumpPrefix;
+	TransientParams transient;
+	OutputParams output;
+	VTUWriter writer;
+	for(int i = 2; i < argc; i++){
+		if(!strcmp(argv[i], "--bench-kernel"))
+			benchKernel = true;
+		else if(!strcmp(argv[i], "--refine") && i + 1 < argc)
+			meshOptions.refine = static_cast<unsigned>(atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--fast-vtk"))
+			meshOptions.fastVtk = true;
+		else if(!strcmp(argv[i], "--mesh-cache") && i + 1 < argc)
+			meshOptions.cacheDir = argv[++i];
+		else if(!strcmp(argv[i], "--format") && i + 1 < argc){
+			i++;
+			if(!parse_output_format(argv[i], output.format)){
+				printf("Unknown output format %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(!strcmp(argv[i], "--encoding") && i + 1 < argc){
+			i++;
+			if(!strcmp(argv[i], "raw"))
+				writer.encoding = VTU_RAW;
+			else if(!strcmp(argv[i], "base64"))
+				writer.encoding = VTU_BASE64;
+			else{
+				printf("Unknown encoding %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(!strcmp(argv[i], "--compress")){
+			writer.compress = vtu_compression_available();
+			if(!writer.compress)
+				printf("Built without zlib, --compress ignored\n");
+		}
+		else if(!strcmp(argv[i], "--fields") && i + 1 < argc)
+			output.fields = vtu_field_list(argv[++i]);
+		else if(!strcmp(argv[i], "--probe") && i + 1 < argc)
+			numProbes = static_cast<unsigned>(atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--quad-degree") && i + 1 < argc)
+			quadDegree = static_cast<unsigned>(atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--profile") && i + 1 < argc)
+			reportFile = argv[++i];
+		else if(!strcmp(argv[i], "--trace") && i + 1 < argc){
+			traceFile = argv[++i];
+			profiler().enableTrace();
+		}
+		else if(!strcmp(argv[i], "--dump-system") && i + 1 < argc)
+			dumpPrefix = argv[++i];
+		else if(!strcmp(argv[i], "--ordering") && i + 1 < argc){
+			if(!parse_ordering(argv[++i], ordering)){
+				printf("Unknown ordering %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(!strcmp(argv[i], "--solver") && i + 1 < argc){
+			i++;
+			if(!parse_solver(argv[i], solverType)){
+				printf("Unknown solver %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc){
+			int numThreads = atoi(argv[++i]);
+#ifdef _OPENMP
+			omp_set_num_threads(numThreads);
+#else
+			if(numThreads > 1)
+				printf("Built without OpenMP, --threads %d ignored\n", numThreads);
+#endif
+		}
+		else if(!strcmp(argv[i], "--steps") && i + 1 < argc)
+			transient.steps = static_cast<unsigned>(atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--dt") && i + 1 < argc)
+			transient.dt = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--theta") && i + 1 < argc)
+			transient.theta = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--mass") && i + 1 < argc){
+			i++;
+			if(!strcmp(argv[i], "consistent"))
+				transient.lumped = false;
+			else if(!strcmp(argv[i], "lumped"))
+				transient.lumped = true;
+			else{
+				printf("Unknown mass matrix %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(!strcmp(argv[i], "--explicit") && i + 1 < argc){
+			i++;
+			if(!strcmp(argv[i], "rkl1"))
+				transient.explicitScheme = STS_RKL1;
+			else if(!strcmp(argv[i], "rkl2"))
+				transient.explicitScheme = STS_RKL2;
+			else{
+				printf("Unknown explicit scheme %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(!strcmp(argv[i], "--dt-growth") && i + 1 < argc)
+			transient.dtGrowth = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--dt-max") && i + 1 < argc)
+			transient.dtMax = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--steady-tol") && i + 1 < argc)
+			transient.steadyTol = atof(argv[++i]);
+		else if(!strcmp(argv[i], "--report-every") && i + 1 < argc)
+			transient.reportEvery = static_cast<unsigned>(atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--output-every") && i + 1 < argc)
+			transient.outputEvery = static_cast<unsigned>(atoi(argv[++i]));
+		else{
+			printf("Unknown option %s\n", argv[i]);
+			return -1;
+		}
+	}
+	if(transient.theta < 0.5 || transient.theta > 1.0){
+		printf("theta must be in [0.5, 1]\n");
+		return -1;
+	}
+	// Multigrid levels are the loaded mesh and its refinements
+	bool multigrid = solverType == SOLVER_MG || solverType == SOLVER_PCG_MG;
+	if(multigrid && (meshOptions.refine == 0 || transient.steps > 0)){
+		printf("--solver mg and pcg-mg need --refine k with k > 0 and a steady solve\n");
+		return -1;
+	}
+
+	Mesh m;
+	PolyMesh coarse;
+	profiler().beginRun(argv[1]);
+	{
+		PROFILE_SCOPE("Mesh::Load");
+		// tri:N is the structured mesh of the unit square, built in memory
+		if(!load_mesh(m, argv[1], meshOptions, &coarse)){
+			printf("Bad mesh %s\n", argv[1]);
+			return -1;
+		}
+	}
+	printf("Mesh: %d cells, %d nodes\n", m.NumberOfCells(), m.NumberOfNodes());
+	Problem P(m);
+	P.setSolver(solverType);
+	if(multigrid){
+		TriMesh coarseTri;
+		if(!poly_to_tri(coarse, coarseTri)){
+			printf("Multigrid needs a triangle mesh\n");
+			return -1;
+		}
+		P.setMultigrid(coarseTri, meshOptions.refine);
+	}
+	P.setDumpPrefix(dumpPrefix);
+	P.setOrdering(ordering);
+	P.setOutput(output, &writer);
+	P.initProblem();
+	if(benchKernel)
+		return P.benchmarkLocalKernel(20) ? 0 : 1;
+	if(transient.steps > 0)
+		P.runTransient(transient);
+	else
+		P.run();
+
+	if(numProbes > 0)
+		P.benchmarkProbes(numProbes);
+
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	ErrorNorms err = P.computeErrorNorms(quadDegree);
+	double tNorms = seconds_since(t0);
+    cout << "|u - u_approx|_C = "  << err.C << endl;
+    cout << "|u - u_approx|_L2 = " << err.L2 << endl;
+    cout << "|u - u_approx|_H1 = " << err.H1 << endl;
+	printf("Error norms: %u-point rule of degree %u, %.3f s\n",
+		tri_quadrature(quadDegree).size, tri_quadrature(quadDegree).degree, tNorms);
+	if(output.format == OUTPUT_VTU){
+		writer.wait();
+		printf("Output: %u files, %.2f MB, written in %.3f s in the background, %.3f s waited for\n",
+			writer.files, writer.bytes / 1048576, writer.writeSeconds, writer.waitSeconds);
+	}
+	if(!reportFile.empty() && !profiler().writeReport(reportFile))
+		printf("Cannot write %s\n", reportFile.c_str());
+	if(!traceFile.empty() && !profiler().writeTrace(traceFile))
+		printf("Cannot write %s\n", traceFile.c_str());
+	printf("Success\n");
+	// Результат c_norm = O(h) and L_norm = O(h^2)
+	return 0;
+}
@@ -0,0 +1,104 @@
+#include "inmost.h"
+#include "mesh_load.h"
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace INMOST;
+using namespace std;
+
+// Load throughput of Mesh::Load against read_vtk (vtk_reader.h), alone
+// and followed by poly_to_mesh, on the given ASCII VTK files. Every
+// variant runs 'repeat' times and the best time is reported; cell and
+// node counts are compared, lines and vertices of Mesh::Load excluded.
+//
+//   load_bench ../meshes/*.vtk ../../task2/data/*.vtk --repeat 5
+
+static double seconds_since(chrono::steady_clock::time_point t0)
+{
+	return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+static size_t file_size(const string &file)
+{
+	FILE *f = fopen(file.c_str(), "rb");
+	if(!f)
+		return 0;
+	fseek(f, 0, SEEK_END);
+	long size = ftell(f);
+	fclose(f);
+	return size > 0 ? static_cast<size_t>(size) : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	unsigned repeat = 3;
+	vector<string> files;
+	for(int i = 1; i < argc; i++){
+		if(!strcmp(argv[i], "--repeat") && i + 1 < argc)
+			repeat = max(1, atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc){
+			int numThreads = atoi(argv[++i]);
+#ifdef _OPENMP
+			omp_set_num_threads(numThreads);
+#else
+			if(numThreads > 1)
+				printf("Built without OpenMP, --threads %d ignored\n", numThreads);
+#endif
+		}
+		else
+			files.push_back(argv[i]);
+	}
+	if(files.empty()){
+		printf("Usage: %s mesh_1.vtk ... mesh_n.vtk [--repeat r] [--threads N]\n", argv[0]);
+		return -1;
+	}
+
+	printf("%-32s %9s %8s %8s | %10s %10s %10s | %8s %8s\n", "file", "KB", "cells", "nodes",
+		"Load ms", "read ms", "+mesh ms", "read x", "+mesh x");
+	bool allMatch = true;
+	for(const string &file : files){
+		double tLoad = 1e300, tRead = 1e300, tBuild = 1e300;
+		int loadCells = 0, loadNodes = 0, buildCells = 0, buildNodes = 0;
+		PolyMesh M;
+		bool ok = true;
+		for(unsigned r = 0; r < repeat; r++){
+			chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+			{
+				Mesh m;
+				m.Load(file);
+				tLoad = min(tLoad, seconds_since(t0));
+				loadCells = m.NumberOfCells();
+				loadNodes = m.NumberOfNodes();
+			}
+			t0 = chrono::steady_clock::now();
+			ok = read_vtk(file, M);
+			tRead = min(tRead, seconds_since(t0));
+			if(!ok)
+				break;
+			{
+				Mesh m;
+				poly_to_mesh(M, m);
+				tBuild = min(tBuild, seconds_since(t0));
+				buildCells = m.NumberOfCells();
+				buildNodes = m.NumberOfNodes();
+			}
+		}
+		if(!ok){
+			printf("%-32s read_vtk cannot read the file\n", file.c_str());
+			allMatch = false;
+			continue;
+		}
+		bool match = loadCells == buildCells && loadNodes == buildNodes;
+		allMatch = allMatch && match;
+		printf("%-32s %9.1f %8u %8u | %10.3f %10.3f %10.3f | %8.1f %8.1f%s\n", file.c_str(),
+			file_size(file) / 1024.0, M.numCells(), M.numNodes(), 1e3 * tLoad, 1e3 * tRead, 1e3 * tBuild,
+			tLoad / tRead, tLoad / tBuild, match ? "" : "  (counts differ from Mesh::Load)");
+	}
+	return allMatch ? 0 : 1;
+}
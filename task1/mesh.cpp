@@ -1,5 +1,7 @@
 #include "inmost.h"
+#include "mesh_load.h"
 #include <stdio.h>
+#include <string.h>
 
 
 using namespace INMOST;
@@ -36,12 +38,19 @@ void make_coord_tag(Mesh* m)
 
 int main(int argc, char *argv[])
 {
-	if (argc != 2) {
-		cout << "Usage: mesh <mesh.vtk>" << endl;
+	MeshLoadOptions options;
+	if (argc == 4 && !strcmp(argv[2], "--mesh-cache"))
+		options.cacheDir = argv[3];
+	else if (argc != 2) {
+		cout << "Usage: mesh <mesh.vtk> [--mesh-cache dir]" << endl;
 		return 1;
 	}
     Mesh *m = new Mesh;
-	m->Load(argv[1]);
+	if (!load_mesh(*m, argv[1], options)) {
+		cout << "Cannot read " << argv[1] << endl;
+		delete m;
+		return 1;
+	}
 	make_node_count_tag(m);
 	make_area_tag(m);
 	make_coord_tag(m);
@@ -0,0 +1,56 @@
+#include "csr_io.h"
+#include <stdio.h>
+#include <iostream>
+#include <string>
+
+using namespace std;
+
+// Converts matrices and vectors between MatrixMarket (.mtx) and the binary
+// formats written by 'diffusion_fem --dump-system': .csrb (CSR matrix)
+// and .vecb (vector). The direction is given by the file extensions.
+
+bool ends_with(const string &s, const string &suffix)
+{
+	return s.size() >= suffix.size() && s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc != 3) {
+		cout << "Usage: mtx_convert <in.csrb|in.vecb|in.mtx> <out.mtx|out.csrb|out.vecb>" << endl;
+		return 1;
+	}
+	string in = argv[1], out = argv[2];
+	bool ok = false;
+	if (ends_with(in, ".csrb") && ends_with(out, ".mtx")) {
+		MappedCSR mapped;
+		CSRMatrix A;
+		if (mapped.open(in)) {
+			mapped.copyTo(A);
+			ok = write_csr_mtx(out, A);
+		}
+	}
+	else if (ends_with(in, ".vecb") && ends_with(out, ".mtx")) {
+		MappedVector mapped;
+		if (mapped.open(in))
+			ok = write_vector_mtx(out, vector<double>(mapped.val, mapped.val + mapped.n));
+	}
+	else if (ends_with(in, ".mtx") && ends_with(out, ".csrb")) {
+		CSRMatrix A;
+		ok = read_csr_mtx(in, A) && write_csr_binary(out, A);
+	}
+	else if (ends_with(in, ".mtx") && ends_with(out, ".vecb")) {
+		vector<double> v;
+		ok = read_vector_mtx(in, v) && write_vector_binary(out, v);
+	}
+	else {
+		cout << "Unsupported conversion " << in << " -> " << out << endl;
+		return 1;
+	}
+	if (!ok) {
+		cout << "Conversion failed" << endl;
+		return 1;
+	}
+	cout << "Success!";
+	return 0;
+}
@@ -0,0 +1,178 @@
+#include "inmost.h"
+#include "diffusion_fem.h"
+#include "tri_mesh.h"
+#include "multigrid.h"
+#include "mesh_load.h"
+#include "memory_usage.h"
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace INMOST;
+using namespace std;
+
+// Geometric multigrid for the P1 FEM problem of diffusion_fem.
+// The loaded mesh is the coarsest level, finer levels are made by uniform
+// refinement in memory, and the problem is solved on every level 1..L with
+// all coarser levels as the hierarchy. Prints one row per level so that
+// iteration counts and time per unknown can be compared across h.
+// A single solve with the same hierarchy is diffusion_fem --solver mg or
+// pcg-mg with --refine L.
+
+/// Flat copy of a triangle mesh loaded by INMOST
+void mesh_to_tri(Mesh &m, TriMesh &T)
+{
+	vector<unsigned> index(m.NodeLastLocalID());
+	T.x.clear();
+	T.y.clear();
+	T.boundary.clear();
+	for(Mesh::iteratorNode inode = m.BeginNode(); inode != m.EndNode(); inode++){
+		Node n = inode->getAsNode();
+		index[n.LocalID()] = T.numNodes();
+		T.x.push_back(n.Coords()[0]);
+		T.y.push_back(n.Coords()[1]);
+		T.boundary.push_back(n.Boundary());
+	}
+	T.tri.clear();
+	for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
+		ElementArray<Node> nodes = icell->getAsCell().getNodes();
+		if(nodes.size() != 3){
+			cout << "Cell is not a triangle!!!";
+			exit(1);
+		}
+		for(unsigned i = 0; i < 3; i++)
+			T.tri.push_back(index[nodes[i].LocalID()]);
+	}
+}
+
+/// Longest edge of the mesh
+double longest_edge(const TriMesh &T)
+{
+	double h = 0.0;
+	for(unsigned k = 0; k < T.tri.size(); k++){
+		unsigned a = T.tri[k], b = T.tri[k - k % 3 + (k + 1) % 3];
+		h = max(h, hypot(T.x[a] - T.x[b], T.y[a] - T.y[b]));
+	}
+	return h;
+}
+
+int main(int argc, char ** argv)
+{
+	if(argc < 2){
+		printf("Usage: %s coarse_mesh_file|tri:N [--levels L] [--cycle v|w] [--mode pcg|mg]\n"
+		       "       [--smooth-degree k] [--threads N]\n", argv[0]);
+		printf("Solves on meshes refined 1..L times, e.g. unit_square1.vtk with 9 levels goes down to h = 1/512\n");
+		return -1;
+	}
+	unsigned numRefinements = 6, smoothDegree = 2;
+	MGCycle cycle = MG_V_CYCLE;
+	bool usePCG = true;
+	for(int i = 2; i < argc; i++){
+		if(!strcmp(argv[i], "--levels") && i + 1 < argc)
+			numRefinements = static_cast<unsigned>(atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--smooth-degree") && i + 1 < argc)
+			smoothDegree = static_cast<unsigned>(atoi(argv[++i]));
+		else if(!strcmp(argv[i], "--cycle") && i + 1 < argc){
+			i++;
+			if(!strcmp(argv[i], "v"))
+				cycle = MG_V_CYCLE;
+			else if(!strcmp(argv[i], "w"))
+				cycle = MG_W_CYCLE;
+			else{
+				printf("Unknown cycle %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(!strcmp(argv[i], "--mode") && i + 1 < argc){
+			i++;
+			if(!strcmp(argv[i], "pcg"))
+				usePCG = true;
+			else if(!strcmp(argv[i], "mg"))
+				usePCG = false;
+			else{
+				printf("Unknown mode %s\n", argv[i]);
+				return -1;
+			}
+		}
+		else if(!strcmp(argv[i], "--threads") && i + 1 < argc){
+			int numThreads = atoi(argv[++i]);
+#ifdef _OPENMP
+			omp_set_num_threads(numThreads);
+#else
+			if(numThreads > 1)
+				printf("Built without OpenMP, --threads %d ignored\n", numThreads);
+#endif
+		}
+		else{
+			printf("Unknown option %s\n", argv[i]);
+			return -1;
+		}
+	}
+
+	// Hierarchy: meshes, free node numbering, matrices, right-hand sides
+	// and prolongations from the previous level
+	vector<TriMesh> meshes(numRefinements + 1);
+	vector<vector<int> > glob(numRefinements + 1);
+	vector<unsigned> numFree(numRefinements + 1);
+	vector<CSRMatrix> A(numRefinements + 1), P(numRefinements + 1);
+	vector<vector<double> > rhs(numRefinements + 1);
+	{
+		Mesh m;
+		if(!load_mesh(m, argv[1], MeshLoadOptions())){
+			printf("Bad mesh %s\n", argv[1]);
+			return -1;
+		}
+		mesh_to_tri(m, meshes[0]);
+	}
+	chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+	for(unsigned l = 0; l <= numRefinements; l++){
+		vector<unsigned> parent;
+		if(l > 0)
+			refine_red(meshes[l - 1], meshes[l], parent);
+		numFree[l] = number_free_nodes(meshes[l], glob[l]);
+		fem::assemble_p1(meshes[l], glob[l], numFree[l], A[l], rhs[l]);
+		if(l > 0)
+			p1_prolongation(parent, glob[l - 1], glob[l], numFree[l], P[l]);
+	}
+	printf("Hierarchy of %u levels built in %.3f s\n", numRefinements + 1, fem::seconds_since(t0));
+
+	const double rtol = 1e-10, atol = 1e-14;
+	printf("\n%5s %10s %10s %6s %10s %10s %12s %12s\n",
+	       "level", "h", "dofs", "iters", "t_setup", "t_solve", "us/dof", "err_C");
+	for(unsigned top = 1; top <= numRefinements; top++){
+		t0 = chrono::steady_clock::now();
+		Multigrid mg;
+		mg.cycle = cycle;
+		mg.smoothDegree = smoothDegree;
+		for(unsigned l = 0; l <= top; l++)
+			mg.addLevel(A[l], P[l]);
+		mg.setup();
+		double tSetup = fem::seconds_since(t0);
+
+		vector<double> x(numFree[top], 0.0);
+		t0 = chrono::steady_clock::now();
+		KrylovStats kstats;
+		if(usePCG){
+			CSROperator op = {&A[top]};
+			kstats = pcg(op, mg, rhs[top], x, rtol, atol, 1000);
+		}
+		else
+			kstats = mg.solve(rhs[top], x, rtol, atol, 1000);
+		double tSolve = fem::seconds_since(t0);
+
+		const TriMesh &T = meshes[top];
+		double errC = 0.0;
+		for(unsigned v = 0; v < T.numNodes(); v++)
+			if(glob[top][v] >= 0)
+				errC = max(errC, fabs(x[glob[top][v]] - fem::C(T.x[v], T.y[v])));
+		printf("%5u %10.3e %10u %6u %10.4f %10.4f %12.4f %12.4e%s\n",
+		       top, longest_edge(T), numFree[top], kstats.iterations, tSetup, tSolve,
+		       1e6 * tSolve / max(numFree[top], 1u), errC, kstats.converged ? "" : "  (not converged)");
+	}
+	printf("Peak RSS: %.1f MB\n", peak_rss_mb());
+	return 0;
+}
@@ -1,15 +1,36 @@
+# Plots the L2 error against the mesh size from the table written by
+# convergence_study, e.g.
+#   convergence_study --method fvm unit_square1.vtk ... unit_square6.vtk
+#   python logplot.py study.csv fvm
+import csv
+import sys
 import matplotlib.pyplot as plt
+
+table = sys.argv[1] if len(sys.argv) > 1 else 'study.csv'
+method = sys.argv[2] if len(sys.argv) > 2 else None
+
+rows = [r for r in csv.DictReader(open(table)) if method is None or r['method'] == method]
+if not rows:
+    sys.exit('No rows in ' + table)
+
 fig = plt.figure()
 ax = fig.add_subplot()
 ax.set_xscale('log')
 ax.set_yscale('log')
 
-diam = [0.5, 0.25, 0.125, 0.0625, 0.03125, 0.015625]
-errL2 = [2.22282, 0.507672, 0.12903, 0.0323996, 0.00810918, 0.00202788]
+# One line per method and solver
+def key(r):
+    return r['method'] + ' ' + r.get('solver', 'inmost')
+
+for m in sorted(set(key(r) for r in rows)):
+    diam = [float(r['h']) for r in rows if key(r) == m]
+    errL2 = [float(r['err_L2']) for r in rows if key(r) == m]
+    ax.plot(diam, errL2, '-o', label='$||u-u_N||_{L_2}$, ' + m)
+
+diam = sorted(set(float(r['h']) for r in rows), reverse=True)
 ord1 = diam
 ord2 = [i ** 2 for i in diam]
 
-ax.plot(diam, errL2, '-bo', label='$||u-u_N||_{L_2}$')
 ax.plot(diam, ord1, '-r', label = '1-й порядок')
 ax.plot(diam, ord2, '-g', label = '2-й порядок')
 ax.legend()
@@ -0,0 +1,331 @@
+#include "inmost.h"
+#include "diffusion_fem.h"
+#include "diffusion_fvm.h"
+#include "mesh_load.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+using namespace INMOST;
+using namespace std;
+
+// Convergence and timing study: runs the FEM and/or FVM solver on a family
+// of meshes in one process and writes one table row per (method, solver,
+// mesh). With several --solvers the table compares time to solution and
+// operator storage of the assembled and matrix-free paths, e.g.
+//
+//   convergence_study --method fem --solvers inmost,mf-jacobi unit_square1.vtk ... unit_square6.vtk
+//   convergence_study --method fvm --solvers inmost,amg,mf-chebyshev cart4.vtk poly4.vtk quad:512 quad:1024
+//
+// Meshes are files or tri:N / quad:N, generated in memory (load_mesh).
+// FEM skips meshes that are not triangular. Rows are appended to the table
+// as the runs complete.
+
+/// One row of the study table
+struct StudyRow
+{
+    string method, solver, mesh;
+    /// Mesh size: the largest cell diameter
+    double h;
+    unsigned dofs, iterations;
+    double errC, errL2;
+    /// Observed orders against the previous mesh of the same method, NaN for the first one
+    double orderC, orderL2;
+    /// Wall times of the phases, seconds
+    double tLoad, tInit, tAssemble, tSolve, tNorms, tTotal;
+    /// Storage of the discrete operator, MB
+    double operatorMB;
+};
+
+/// Largest distance between two nodes of one cell
+double mesh_size(Mesh &m)
+{
+    double h = 0.0;
+    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
+        ElementArray<Node> nodes = icell->getAsCell().getNodes();
+        for(unsigned i = 0; i < nodes.size(); i++){
+            for(unsigned j = i + 1; j < nodes.size(); j++){
+                double ddx = nodes[i].Coords()[0] - nodes[j].Coords()[0];
+                double ddy = nodes[i].Coords()[1] - nodes[j].Coords()[1];
+                h = max(h, sqrt(ddx*ddx + ddy*ddy));
+            }
+        }
+    }
+    return h;
+}
+
+/// True if every cell of the mesh is a triangle
+bool all_triangles(Mesh &m)
+{
+    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++)
+        if(icell->getAsCell().getNodes().size() != 3)
+            return false;
+    return true;
+}
+
+/// Fills row with a FEM run on the mesh, false if the mesh cannot be used
+bool run_fem(const char *meshFile, const char *solver, fem::SolverType solverType, StudyRow &row)
+{
+    row.method = "fem";
+    row.solver = solver;
+    row.mesh = meshFile;
+    profiler().beginRun(row.method + ":" + row.solver + ":" + row.mesh);
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now(), t0 = tStart;
+
+    Mesh m;
+    {
+        PROFILE_SCOPE("Mesh::Load");
+        if(!load_mesh(m, meshFile, MeshLoadOptions())){
+            printf("Bad mesh %s, skipped\n", meshFile);
+            return false;
+        }
+    }
+    // fem::Problem only handles P1 triangles
+    if(!all_triangles(m)){
+        printf("Mesh %s is not triangular, FEM skipped\n", meshFile);
+        return false;
+    }
+    row.tLoad = fem::seconds_since(t0);
+    row.h = mesh_size(m);
+
+    t0 = chrono::steady_clock::now();
+    fem::Problem P(m);
+    P.setSolver(solverType);
+    // Only the norms and timings are wanted, no result files
+    OutputParams output;
+    output.format = OUTPUT_NONE;
+    P.setOutput(output, NULL);
+    P.initProblem();
+    row.tInit = fem::seconds_since(t0);
+
+    P.run();
+
+    t0 = chrono::steady_clock::now();
+    fem::ErrorNorms norms = P.computeErrorNorms();
+    row.errC = norms.C;
+    row.errL2 = norms.L2;
+    row.tNorms = fem::seconds_since(t0);
+
+    const fem::RunStats &stats = P.getStats();
+    row.dofs = stats.dofs;
+    row.iterations = stats.iterations;
+    row.tAssemble = stats.tAssemble;
+    row.tSolve = stats.tSolve;
+    row.operatorMB = stats.operatorMB;
+    row.tTotal = fem::seconds_since(tStart);
+    return true;
+}
+
+/// Fills row with an FVM run on the mesh, false if the mesh cannot be loaded
+bool run_fvm(const char *meshFile, const char *solver, fvm::SolverType solverType, StudyRow &row)
+{
+    row.method = "fvm";
+    row.solver = solver;
+    row.mesh = meshFile;
+    profiler().beginRun(row.method + ":" + row.solver + ":" + row.mesh);
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now(), t0 = tStart;
+
+    Mesh m;
+    {
+        PROFILE_SCOPE("Mesh::Load");
+        if(!load_mesh(m, meshFile, MeshLoadOptions())){
+            printf("Bad mesh %s, skipped\n", meshFile);
+            return false;
+        }
+    }
+    row.tLoad = fvm::seconds_since(t0);
+    row.h = mesh_size(m);
+
+    t0 = chrono::steady_clock::now();
+    fvm::Problem P(m);
+    P.setSolver(solverType);
+    OutputParams output;
+    output.format = OUTPUT_NONE;
+    P.setOutput(output, NULL);
+    P.initProblem();
+    row.tInit = fvm::seconds_since(t0);
+
+    // Errors are computed inside run()
+    P.run();
+
+    const fvm::RunStats &stats = P.getStats();
+    row.dofs = stats.dofs;
+    row.iterations = stats.iterations;
+    row.errC = stats.normC;
+    row.errL2 = stats.normL2;
+    row.tAssemble = stats.tAssemble;
+    row.tSolve = stats.tSolve;
+    row.tNorms = stats.tNorms;
+    row.operatorMB = stats.operatorMB;
+    row.tTotal = fvm::seconds_since(tStart);
+    return true;
+}
+
+/// Items of a comma-separated list
+static vector<string> split_list(const char *list)
+{
+    vector<string> items;
+    for(const char *p = list; *p; ){
+        const char *end = strchr(p, ',');
+        size_t len = end ? static_cast<size_t>(end - p) : strlen(p);
+        if(len > 0)
+            items.push_back(string(p, len));
+        p += end ? len + 1 : len;
+    }
+    return items;
+}
+
+/// Observed orders of row against prev, the previous mesh of the same method and solver
+void compute_orders(const StudyRow *prev, StudyRow &row)
+{
+    row.orderC = row.orderL2 = NAN;
+    if(!prev || prev->method != row.method || prev->solver != row.solver)
+        return;
+    double hRatio = log(prev->h / row.h);
+    row.orderC = log(prev->errC / row.errC) / hRatio;
+    row.orderL2 = log(prev->errL2 / row.errL2) / hRatio;
+}
+
+/// JSON number, null for NaN
+static string json_num(double v, const char *fmt)
+{
+    if(std::isnan(v))
+        return "null";
+    char buf[64];
+    snprintf(buf, sizeof(buf), fmt, v);
+    return buf;
+}
+
+// The table is written row by row as the runs complete, so the rows
+// finished before a failing run are kept
+void write_header(FILE *f, bool json)
+{
+    if(json)
+        fprintf(f, "[");
+    else
+        fprintf(f, "method,solver,mesh,h,dofs,iterations,err_C,err_L2,order_C,order_L2,"
+                   "t_load,t_init,t_assemble,t_solve,t_norms,t_total,operator_mb\n");
+    fflush(f);
+}
+
+void write_row(FILE *f, bool json, const StudyRow &r, bool first)
+{
+    if(json)
+        fprintf(f, "%s\n  {\"method\": \"%s\", \"solver\": \"%s\", \"mesh\": %s, \"h\": %.10e, \"dofs\": %u, \"iterations\": %u, "
+                   "\"err_C\": %.10e, \"err_L2\": %.10e, \"order_C\": %s, \"order_L2\": %s, "
+                   "\"t_load\": %.6f, \"t_init\": %.6f, \"t_assemble\": %.6f, \"t_solve\": %.6f, "
+                   "\"t_norms\": %.6f, \"t_total\": %.6f, \"operator_mb\": %s}",
+                first ? "" : ",", r.method.c_str(), r.solver.c_str(), json_escape(r.mesh).c_str(), r.h, r.dofs, r.iterations,
+                r.errC, r.errL2, json_num(r.orderC, "%.4f").c_str(), json_num(r.orderL2, "%.4f").c_str(),
+                r.tLoad, r.tInit, r.tAssemble, r.tSolve, r.tNorms, r.tTotal, json_num(r.operatorMB, "%.3f").c_str());
+    else
+        fprintf(f, "%s,%s,%s,%.10e,%u,%u,%.10e,%.10e,%.4f,%.4f,%.6f,%.6f,%.6f,%.6f,%.6f,%.6f,%.3f\n",
+                r.method.c_str(), r.solver.c_str(), r.mesh.c_str(), r.h, r.dofs, r.iterations, r.errC, r.errL2,
+                r.orderC, r.orderL2, r.tLoad, r.tInit, r.tAssemble, r.tSolve, r.tNorms, r.tTotal, r.operatorMB);
+    fflush(f);
+}
+
+void write_footer(FILE *f, bool json)
+{
+    if(json)
+        fprintf(f, "\n]\n");
+}
+
+int main(int argc, char ** argv)
+{
+    const char *method = "both";
+    string output = "study.csv", reportFile, traceFile;
+    vector<string> solvers(1, "inmost");
+    vector<const char *> meshes;
+    for(int i = 1; i < argc; i++){
+        if(!strcmp(argv[i], "--method") && i + 1 < argc)
+            method = argv[++i];
+        else if(!strcmp(argv[i], "--solvers") && i + 1 < argc)
+            solvers = split_list(argv[++i]);
+        else if(!strcmp(argv[i], "--output") && i + 1 < argc)
+            output = argv[++i];
+        else if(!strcmp(argv[i], "--profile") && i + 1 < argc)
+            reportFile = argv[++i];
+        else if(!strcmp(argv[i], "--trace") && i + 1 < argc){
+            traceFile = argv[++i];
+            profiler().enableTrace();
+        }
+        else
+            meshes.push_back(argv[i]);
+    }
+    bool doFem = !strcmp(method, "fem") || !strcmp(method, "both");
+    bool doFvm = !strcmp(method, "fvm") || !strcmp(method, "both");
+    if(meshes.empty() || (!doFem && !doFvm)){
+        printf("Usage: %s [--method fem|fvm|both] [--solvers name,name,...] [--output study.csv|study.json]\n"
+               "       [--profile report.json] [--trace trace.json] mesh_1 ... mesh_n\n", argv[0]);
+        printf("FEM solvers: inmost, mf-jacobi, mf-chebyshev; FVM solvers: inmost, amg, mf-jacobi, mf-chebyshev\n");
+        printf("Meshes are files or tri:N / quad:N, the structured N x N mesh of the unit square\n");
+        printf("Meshes should go from coarse to fine, e.g. unit_square1.vtk ... unit_square6.vtk\n");
+        return -1;
+    }
+
+    FILE *f = fopen(output.c_str(), "w");
+    if(!f){
+        printf("Cannot open %s\n", output.c_str());
+        return 1;
+    }
+    bool json = output.size() >= 5 && output.compare(output.size() - 5, 5, ".json") == 0;
+    write_header(f, json);
+
+    vector<StudyRow> rows;
+    StudyRow row;
+    // Completes the orders of a finished run and appends it to the table
+    auto add_row = [&](StudyRow &r){
+        compute_orders(rows.empty() ? NULL : &rows.back(), r);
+        write_row(f, json, r, rows.empty());
+        rows.push_back(r);
+    };
+    if(doFem){
+        for(const string &solver : solvers){
+            fem::SolverType solverType;
+            if(!fem::parse_solver(solver.c_str(), solverType)){
+                printf("No FEM solver %s, skipped\n", solver.c_str());
+                continue;
+            }
+            // The multigrid hierarchy comes from diffusion_fem --refine, not from a mesh list
+            if(solverType == fem::SOLVER_MG || solverType == fem::SOLVER_PCG_MG){
+                printf("FEM solver %s is not run by the study, skipped\n", solver.c_str());
+                continue;
+            }
+            for(const char *mesh : meshes)
+                if(run_fem(mesh, solver.c_str(), solverType, row))
+                    add_row(row);
+        }
+    }
+    if(doFvm){
+        for(const string &solver : solvers){
+            fvm::SolverType solverType;
+            if(!fvm::parse_solver(solver.c_str(), solverType)){
+                printf("No FVM solver %s, skipped\n", solver.c_str());
+                continue;
+            }
+            for(const char *mesh : meshes)
+                if(run_fvm(mesh, solver.c_str(), solverType, row))
+                    add_row(row);
+        }
+    }
+    write_footer(f, json);
+    fclose(f);
+
+    printf("\n%-6s %-12s %-28s %10s %9s %6s %12s %12s %7s %7s %9s %9s %9s\n",
+           "method", "solver", "mesh", "h", "dofs", "iters", "err_C", "err_L2", "ord_C", "ord_L2",
+           "t_asm", "t_solve", "op_MB");
+    for(const StudyRow &r : rows)
+        printf("%-6s %-12s %-28s %10.3e %9u %6u %12.4e %12.4e %7.3f %7.3f %9.3f %9.3f %9.2f\n",
+               r.method.c_str(), r.solver.c_str(), r.mesh.c_str(), r.h, r.dofs, r.iterations, r.errC, r.errL2,
+               r.orderC, r.orderL2, r.tAssemble, r.tSolve, r.operatorMB);
+    printf("Table written to %s\n", output.c_str());
+    if(!reportFile.empty() && !profiler().writeReport(reportFile))
+        printf("Cannot write %s\n", reportFile.c_str());
+    if(!traceFile.empty() && !profiler().writeTrace(traceFile))
+        printf("Cannot write %s\n", traceFile.c_str());
+    return 0;
+}
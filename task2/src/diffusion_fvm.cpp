@@ -1,74 +1,19 @@
-#include "inmost.h"
+#include "diffusion_fvm.h"
+#include "profiler.h"
 #include <stdio.h>
-#include <math.h>
+#include <algorithm>
+#include <memory>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 using namespace INMOST;
 using namespace std;
 
-const double dx = 1.0;
-const double dy = 1.0;
-const double dxy = 0.0;
-const double a = 10;
-
-double C(double x, double y) // analytical solution
-{
-    return sin(a*x) * sin(a*y);
-}
-
-double source(double x, double y)
-{
-    return -a*a * (2.*dxy * cos(a*x)*cos(a*y) - (dx+dy) * sin(a*x)*sin(a*y));
-}
-
-enum BoundCondType
+namespace fvm
 {
-    BC_DIR = 1,
-    BC_NEUM = 2
-};
 
-// Class including everything needed
-class Problem
-{
-private:
-    /// Mesh
-    Mesh &m;
-    // =========== Tags =============
-    /// Solution tag: 1 real value per cell
-    Tag tagConc;
-    /// Diffusion tensor tag: 3 real values (Dx, Dy, Dxy) per cell
-    Tag tagD;
-    /// Boundary condition type tag: 1 integer value per face, sparse on faces
-    Tag tagBCtype;
-    /// Boundary condition value tag: 1 real value per face, sparse on faces
-    Tag tagBCval;
-    /// Right-hand side tag: 1 real value per cell
-    Tag tagSource;
-    /// Analytical solution tag: 1 real value per cell
-    Tag tagConcAn;
-    /// Global index tag: 1 integer value per cell
-    Tag tagGlobInd;
-    /// Boundary conductivity: 1 real value per face, sparse on faces
-    Tag tagBCcond;
-
-    // =========== Tag names ===========
-    const string tagNameConc = "Concentration";
-    const string tagNameD = "Diffusion_tensor";
-    const string tagNameBCtype = "BC_type";
-    const string tagNameBCval = "BC_value";
-    const string tagNameSource = "Source";
-    const string tagNameConcAn = "Concentration_analytical";
-    const string tagNameGlobInd = "Global_Index";
-    const string tagNameBCcond = "BC_conductivity";
-
-public:
-    Problem(Mesh &m_);
-    ~Problem();
-    void initProblem();
-    void assembleGlobalSystem(Sparse::Matrix &A, Sparse::Vector &rhs);
-    void run();
-};
-
-Problem::Problem(Mesh &m_) : m(m_)
+Problem::Problem(Mesh &m_) : m(m_), ordering(ORDER_NATIVE), solverType(SOLVER_INMOST), parallelAssembly(false)
 {
 }
 
@@ -89,6 +34,7 @@ double calc_tf(rMatrix const& D, rMatrix const& nf, double *dA){
 
 void Problem::initProblem()
 {
+    PROFILE_SCOPE("initProblem");
     // Init tags
     tagConc = m.CreateTag(tagNameConc, DATA_REAL, CELL, NONE, 1);
     tagD = m.CreateTag(tagNameD, DATA_REAL, CELL, NONE, 3);
@@ -162,32 +108,93 @@ void Problem::initProblem()
             f.Real(tagBCcond) = tfA * tfB / (tfA - tfB);
         }
     }
+
+    if(ordering != ORDER_NATIVE)
+        renumberCells();
+    buildFaceCache();
 }
 
-void Problem::assembleGlobalSystem(Sparse::Matrix &M, Sparse::Vector &rhs)
+// Renumbering of cells: RCM on the cell adjacency graph (cells sharing
+// a face) or a space-filling curve through cell barycenters
+void Problem::renumberCells()
 {
-    // Face loop
-    // Calculate transmissibilities using
-    // two-point flux approximation (TPFA)
+    PROFILE_SCOPE("renumberCells");
+    unsigned N = static_cast<unsigned>(m.NumberOfCells());
+    vector<unsigned> start(N + 1, 0), adj;
     for(Mesh::iteratorFace iface = m.BeginFace(); iface != m.EndFace(); iface++){
         Face f = iface->getAsFace();
-        double xf[2];
-        rMatrix nf(2,1);
-        f.UnitNormal(nf.data());
-        f.Barycenter(xf);
-        if(f.Boundary()){
-            int BCtype = f.Integer(tagBCtype);
-            if(BCtype == BC_NEUM){
-                continue;
-            }
-            else if(BCtype == BC_DIR){
-                // implement by yourself
-                Cell A;
-                A = f.BackCell();
+        if(f.Boundary())
+            continue;
+        start[f.BackCell().Integer(tagGlobInd) + 1]++;
+        start[f.FrontCell().Integer(tagGlobInd) + 1]++;
+    }
+    for(unsigned i = 0; i < N; i++)
+        start[i + 1] += start[i];
+    adj.resize(start[N]);
+    vector<unsigned> fill(start.begin(), start.end() - 1);
+    for(Mesh::iteratorFace iface = m.BeginFace(); iface != m.EndFace(); iface++){
+        Face f = iface->getAsFace();
+        if(f.Boundary())
+            continue;
+        unsigned idA = f.BackCell().Integer(tagGlobInd);
+        unsigned idB = f.FrontCell().Integer(tagGlobInd);
+        adj[fill[idA]++] = idB;
+        adj[fill[idB]++] = idA;
+    }
 
-                double xA[2];
-                A.Barycenter(xA);
+    vector<unsigned> perm;
+    if(ordering == ORDER_RCM)
+        perm = rcm_ordering(N, start, adj);
+    else{
+        vector<double> x(N), y(N);
+        for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
+            double xc[2];
+            icell->Barycenter(xc);
+            unsigned i = icell->Integer(tagGlobInd);
+            x[i] = xc[0];
+            y[i] = xc[1];
+        }
+        perm = curve_ordering(N, x, y, ordering);
+    }
 
+    unsigned bw0, bw1;
+    unsigned long long pr0, pr1;
+    bandwidth_profile(N, start, adj, vector<unsigned>(), bw0, pr0);
+    bandwidth_profile(N, start, adj, perm, bw1, pr1);
+    printf("Renumbering: bandwidth %u -> %u, profile %llu -> %llu\n", bw0, bw1, pr0, pr1);
+
+    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++)
+        icell->Integer(tagGlobInd) = perm[icell->Integer(tagGlobInd)];
+}
+
+// One pass over the mesh: face and cell arrays for the assembly
+// and the matrix-free operator
+void Problem::buildFaceCache()
+{
+    PROFILE_SCOPE("buildFaceCache");
+    unsigned N = static_cast<unsigned>(m.NumberOfCells());
+    intCellA.clear();
+    intCellB.clear();
+    intTrans.clear();
+    bndCell.clear();
+    bndTrans.clear();
+    bndType.clear();
+    bndValue.clear();
+    // Faces of every cell in face loop order, as (cell, face code) pairs
+    vector<pair<unsigned, int> > incidence;
+    for(Mesh::iteratorFace iface = m.BeginFace(); iface != m.EndFace(); iface++){
+        Face f = iface->getAsFace();
+        if(f.Boundary()){
+            Cell A = f.BackCell();
+            unsigned id = static_cast<unsigned>(A.Integer(tagGlobInd));
+            int type = f.Integer(tagBCtype);
+            double t = 0.0;
+            if(type == BC_DIR){
+                double xf[2], xA[2];
+                rMatrix nf(2,1);
+                f.UnitNormal(nf.data());
+                f.Barycenter(xf);
+                A.Barycenter(xA);
                 double dA[2] = {xf[0] - xA[0], xf[1] - xA[1]};
 
                 rMatrix DA(2, 2);
@@ -195,75 +202,388 @@ void Problem::assembleGlobalSystem(Sparse::Matrix &M, Sparse::Vector &rhs)
                 DA(0, 1) = A.RealArray(tagD)[2];
                 DA(1, 0) = A.RealArray(tagD)[2];
                 DA(1, 1) = A.RealArray(tagD)[1];
-
-                double t = calc_tf(DA, nf, dA); // transmissibility
-                
-                int id = A.Integer(tagGlobInd);
-                M[id][id] -= t * f.Area();
-                rhs[id] -= t * f.Real(tagBCval) * f.Area();
+                t = calc_tf(DA, nf, dA); // transmissibility
             }
+            incidence.push_back(make_pair(id, -static_cast<int>(bndCell.size()) - 1));
+            bndCell.push_back(id);
+            bndTrans.push_back(t * f.Area());
+            bndType.push_back(type);
+            bndValue.push_back(type == BC_DIR ? f.Real(tagBCval) : 0.0);
         }
         else{
-            // Internal face
-            Cell cA, cB;
-            cA = f.BackCell();
-            cB = f.FrontCell();
-            if(!cB.isValid()){
-                cout << "Invalid FrontCell!" << endl;
-                exit(1);
-            }
-
-            // implement by yourself
-            double t = f.Real(tagBCcond);
-            int idA = cA.Integer(tagGlobInd);
-            int idB = cB.Integer(tagGlobInd);
-            M[idA][idA] += t * f.Area();
-            M[idA][idB] -= t * f.Area();
-            M[idB][idA] -= t * f.Area();
-            M[idB][idB] += t * f.Area();
+            unsigned idA = static_cast<unsigned>(f.BackCell().Integer(tagGlobInd));
+            unsigned idB = static_cast<unsigned>(f.FrontCell().Integer(tagGlobInd));
+            incidence.push_back(make_pair(idA, static_cast<int>(intCellA.size())));
+            incidence.push_back(make_pair(idB, static_cast<int>(intCellA.size())));
+            intCellA.push_back(idA);
+            intCellB.push_back(idB);
+            intTrans.push_back(f.Real(tagBCcond) * f.Area());
         }
     }
-    for(auto icell = m.BeginCell(); icell != m.EndCell(); icell++){
+    cellVolume.assign(N, 0.0);
+    cellLoad.assign(N, 0.0);
+    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
         Cell c = icell->getAsCell();
-        int i = c.Integer(tagGlobInd);
-        rhs[i] -= c.Real(tagSource) * c.Volume();
+        cellVolume[c.Integer(tagGlobInd)] = c.Volume();
+        cellLoad[c.Integer(tagGlobInd)] = c.Real(tagSource) * c.Volume();
+    }
+
+    // Cell-to-face lists: interior faces, then boundary faces, each in face
+    // loop order (the sort is stable), the order of assembleGlobalSystem
+    stable_sort(incidence.begin(), incidence.end(),
+                [](const pair<unsigned, int> &a, const pair<unsigned, int> &b){
+                    return a.first < b.first || (a.first == b.first && a.second >= 0 && b.second < 0);
+                });
+    cellFaceStart.assign(N + 1, 0);
+    cellFaces.resize(incidence.size());
+    for(size_t l = 0; l < incidence.size(); l++){
+        cellFaceStart[incidence[l].first + 1]++;
+        cellFaces[l] = incidence[l].second;
     }
+    for(unsigned i = 0; i < N; i++)
+        cellFaceStart[i + 1] += cellFaceStart[i];
+
+    matrix.n = N;
+    printf("Faces: %zu interior, %zu boundary\n", intCellA.size(), bndCell.size());
 }
 
-void Problem::run()
+// CSR pattern of the matrix: the diagonal and the neighbours through
+// interior faces, and the slots of every face in it. Only the assembled
+// solvers need it, so it is built on the first assembly.
+void Problem::buildMatrixPattern()
 {
-    // Matrix size
-    unsigned N = static_cast<unsigned>(m.NumberOfCells());
-    // Global matrix called 'stiffness matrix'
-    Sparse::Matrix A;
-    // Solution vector
-    Sparse::Vector sol;
-    // Right-hand side vector
-    Sparse::Vector rhs;
-    std::cout << "N = " << N << "\n";
+    PROFILE_SCOPE("buildMatrixPattern");
+    unsigned N = matrix.n;
+    matrix.rowStart.assign(N + 1, 0);
+    matrix.col.clear();
+    vector<unsigned> cols;
+    for(unsigned i = 0; i < N; i++){
+        cols.assign(1, i);
+        for(unsigned l = cellFaceStart[i]; l < cellFaceStart[i + 1]; l++){
+            int k = cellFaces[l];
+            if(k >= 0)
+                cols.push_back(intCellA[k] == i ? intCellB[k] : intCellA[k]);
+        }
+        sort(cols.begin(), cols.end());
+        cols.erase(unique(cols.begin(), cols.end()), cols.end());
+        matrix.col.insert(matrix.col.end(), cols.begin(), cols.end());
+        matrix.rowStart[i + 1] = matrix.nnz();
+    }
+    matrix.val.assign(matrix.nnz(), 0.0);
+    diagSlot.resize(N);
+    for(unsigned i = 0; i < N; i++)
+        diagSlot[i] = static_cast<unsigned>(matrix.slot(i, i));
+    intSlot.resize(4 * intCellA.size());
+    for(size_t k = 0; k < intCellA.size(); k++){
+        unsigned a = intCellA[k], b = intCellB[k];
+        intSlot[4*k + 0] = diagSlot[a];
+        intSlot[4*k + 1] = static_cast<unsigned>(matrix.slot(a, b));
+        intSlot[4*k + 2] = static_cast<unsigned>(matrix.slot(b, a));
+        intSlot[4*k + 3] = diagSlot[b];
+    }
+    printf("Matrix nonzeros: %u\n", matrix.nnz());
+}
 
-    A.SetInterval(0, N);
-    sol.SetInterval(0, N);
-    rhs.SetInterval(0, N);
+// Face loop over the cache: two-point flux approximation (TPFA),
+// four updates per interior face, one per Dirichlet face
+void Problem::assembleGlobalSystem(vector<double> &rhs)
+{
+    PROFILE_SCOPE("assembleGlobalSystem");
+    if(matrix.rowStart.empty())
+        buildMatrixPattern();
+    double *val = matrix.val.data();
+    fill(matrix.val.begin(), matrix.val.end(), 0.0);
+    rhs.assign(matrix.n, 0.0);
+    for(size_t k = 0; k < intTrans.size(); k++){
+        double t = intTrans[k];
+        val[intSlot[4*k + 0]] += t;
+        val[intSlot[4*k + 1]] -= t;
+        val[intSlot[4*k + 2]] -= t;
+        val[intSlot[4*k + 3]] += t;
+    }
+    for(size_t k = 0; k < bndTrans.size(); k++){
+        if(bndType[k] != BC_DIR)
+            continue;
+        unsigned id = bndCell[k];
+        val[diagSlot[id]] -= bndTrans[k];
+        rhs[id] -= bndTrans[k] * bndValue[k];
+    }
+    for(unsigned i = 0; i < matrix.n; i++)
+        rhs[i] -= cellLoad[i];
+}
+
+// Cell-centric assembly: every cell gathers the fluxes through its own
+// faces into its own row, so cells are processed in parallel without
+// conflicts. A cell visits its interior faces and then its boundary faces,
+// each in cache order like assembleGlobalSystem, so every sum adds the
+// same terms in the same order and the matrix is identical bit for bit.
+void Problem::assembleCellCentric(vector<double> &rhs)
+{
+    PROFILE_SCOPE("assembleCellCentric");
+    if(matrix.rowStart.empty())
+        buildMatrixPattern();
+    double *val = matrix.val.data();
+    int N = static_cast<int>(matrix.n);
+    rhs.resize(N);
+#pragma omp parallel for schedule(static)
+    for(int i = 0; i < N; i++){
+        for(unsigned l = matrix.rowStart[i]; l < matrix.rowStart[i + 1]; l++)
+            val[l] = 0.0;
+        double b = 0.0;
+        for(unsigned l = cellFaceStart[i]; l < cellFaceStart[i + 1]; l++){
+            int k = cellFaces[l];
+            if(k >= 0){
+                double t = intTrans[k];
+                bool isA = intCellA[k] == static_cast<unsigned>(i);
+                val[diagSlot[i]] += t;
+                val[intSlot[4*k + (isA ? 1 : 2)]] -= t;
+            }
+            else{
+                k = -k - 1;
+                if(bndType[k] != BC_DIR)
+                    continue;
+                val[diagSlot[i]] -= bndTrans[k];
+                b -= bndTrans[k] * bndValue[k];
+            }
+        }
+        rhs[i] = b - cellLoad[i];
+    }
+}
 
-    assembleGlobalSystem(A, rhs);
+// Assembles the system both ways and compares them entry by entry
+void Problem::checkAssembly()
+{
+    vector<double> b1, b2;
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    assembleGlobalSystem(b1);
+    double tSerial = seconds_since(t0);
+    vector<double> v1(matrix.val);
+    t0 = chrono::steady_clock::now();
+    assembleCellCentric(b2);
+    double tParallel = seconds_since(t0);
+
+    unsigned mismatches = 0;
+    for(unsigned l = 0; l < matrix.nnz(); l++)
+        mismatches += v1[l] != matrix.val[l];
+    for(unsigned i = 0; i < matrix.n; i++)
+        mismatches += b1[i] != b2[i];
+    int numThreads = 1;
+#ifdef _OPENMP
+    numThreads = omp_get_max_threads();
+#endif
+    printf("Assembly check: face loop %.4f s, cell loop on %d threads %.4f s, %u entries differ\n",
+           tSerial, numThreads, tParallel, mismatches);
+}
 
+// Net diffusive flux out of the domain against the total source: the two
+// agree up to the solver tolerance, since TPFA is locally conservative
+void Problem::boundaryBalance(const vector<double> &sol) const
+{
+    PROFILE_SCOPE("boundaryBalance");
+    double outflux = 0.0, load = 0.0;
+    int numBnd = static_cast<int>(bndTrans.size()), N = static_cast<int>(matrix.n);
+#pragma omp parallel for reduction(+:outflux) schedule(static)
+    for(int k = 0; k < numBnd; k++)
+        if(bndType[k] == BC_DIR)
+            outflux += bndTrans[k] * (sol[bndCell[k]] - bndValue[k]);
+#pragma omp parallel for reduction(+:load) schedule(static)
+    for(int i = 0; i < N; i++)
+        load += cellLoad[i];
+    printf("Boundary outflux: %e, total source: %e, imbalance: %e\n", outflux, load, fabs(outflux - load));
+}
+
+void Problem::solveInmost(const vector<double> &b, vector<double> &sol)
+{
+    unsigned N = matrix.n;
+    Sparse::Matrix A;
+    Sparse::Vector rhs, x;
+    csr_to_sparse(matrix, A);
+    rhs.SetInterval(0, N);
+    x.SetInterval(0, N);
+    for(unsigned i = 0; i < N; i++)
+        rhs[i] = b[i];
     string solver_name = "inner_mptiluc";
     Solver S(solver_name);
     S.SetParameter("drop_tolerance", "0");
-    S.SetParameter("absolute_tolerance", "1e-14");
+    char atol[32];
+    snprintf(atol, sizeof(atol), "%g", absoluteTolerance(b));
+    S.SetParameter("absolute_tolerance", atol);
     S.SetParameter("relative_tolerance", "1e-10");
+    if(!initialGuess.empty())
+        for(unsigned i = 0; i < N; i++)
+            x[i] = initialGuess[i];
 
-
-    S.SetMatrix(A);
-    bool solved = S.Solve(rhs, sol);
+    {
+        PROFILE_SCOPE("SetMatrix");
+        S.SetMatrix(A);
+    }
+    bool solved;
+    {
+        PROFILE_SCOPE("Solve");
+        solved = S.Solve(rhs, x);
+    }
+    stats.iterations = static_cast<unsigned>(S.Iterations());
     printf("Number of iterations: %d\n", S.Iterations());
     printf("Residual:             %e\n", S.Residual());
+    printf("Preconditioner time:  %f s\n", S.PreconditionerTime());
+    printf("Iterations time:      %f s\n", S.IterationsTime());
     if(!solved){
         printf("Linear solver failed: %s\n", S.GetReason().c_str());
         exit(1);
     }
+    sol.resize(N);
+    for(unsigned i = 0; i < N; i++)
+        sol[i] = x[i];
+}
 
+// The assembled matrix is negative definite (fluxes are summed with the
+// sign of the transmissibilities), so CG runs on -A u = -rhs
+void Problem::solveAMG(const vector<double> &rhs, vector<double> &sol)
+{
+    unsigned N = matrix.n;
+    CSRMatrix K(matrix);
+    vector<double> b(N);
+    for(double &v : K.val)
+        v = -v;
+    for(unsigned i = 0; i < N; i++)
+        b[i] = -rhs[i];
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    {
+        PROFILE_SCOPE("AMG setup");
+        amg_setup(K, AMGParams(), amg);
+    }
+    double tSetup = seconds_since(t0);
+
+    t0 = chrono::steady_clock::now();
+    if(initialGuess.empty())
+        sol.assign(N, 0.0);
+    else
+        sol = initialGuess;
+    CSROperator op = {&K};
+    KrylovStats kstats;
+    {
+        PROFILE_SCOPE("Solve");
+        kstats = pcg(op, amg, b, sol, 1e-10, absoluteTolerance(b), 1000);
+    }
+    stats.iterations = kstats.iterations;
+    printf("Number of iterations: %u\n", kstats.iterations);
+    printf("Residual:             %e\n", kstats.residual);
+    printf("AMG setup time:       %f s\n", tSetup);
+    printf("Iterations time:      %f s\n", seconds_since(t0));
+    if(!kstats.converged){
+        printf("Linear solver failed: no convergence\n");
+        exit(1);
+    }
+}
+
+// Right-hand side of the SPD system -A u = -rhs without the matrix:
+// Dirichlet fluxes plus the source
+void Problem::assembleRhs(vector<double> &rhs) const
+{
+    PROFILE_SCOPE("assembleRhs");
+    rhs.assign(cellLoad.begin(), cellLoad.end());
+    for(size_t k = 0; k < bndTrans.size(); k++)
+        if(bndType[k] == BC_DIR)
+            rhs[bndCell[k]] += bndTrans[k] * bndValue[k];
+}
+
+// Matrix-free TPFA operator of the SPD system, y = -A x:
+// y_i = sum over interior faces of |T| (x_i - x_j) + sum over Dirichlet
+// faces of T x_i. Gathered per cell, so rows are computed in parallel.
+void Problem::applyOperator(const double *x, double *y) const
+{
+    int N = static_cast<int>(matrix.n);
+#pragma omp parallel for schedule(static)
+    for(int i = 0; i < N; i++){
+        double xi = x[i], s = 0.0;
+        for(unsigned l = cellFaceStart[i]; l < cellFaceStart[i + 1]; l++){
+            int k = cellFaces[l];
+            if(k >= 0){
+                unsigned j = intCellA[k] == static_cast<unsigned>(i) ? intCellB[k] : intCellA[k];
+                s -= intTrans[k] * (xi - x[j]);
+            }
+            else if(bndType[-k - 1] == BC_DIR)
+                s += bndTrans[-k - 1] * xi;
+        }
+        y[i] = s;
+    }
+}
+
+// Diagonal of -A and the Gershgorin bound max_i sum_j |a_ij| / a_ii
+void Problem::operatorDiagonal(vector<double> &diag, double &gershgorin) const
+{
+    unsigned N = matrix.n;
+    diag.assign(N, 0.0);
+    gershgorin = 0.0;
+    for(unsigned i = 0; i < N; i++){
+        double offSum = 0.0;
+        for(unsigned l = cellFaceStart[i]; l < cellFaceStart[i + 1]; l++){
+            int k = cellFaces[l];
+            if(k >= 0){
+                diag[i] -= intTrans[k];
+                offSum -= intTrans[k];
+            }
+            else if(bndType[-k - 1] == BC_DIR)
+                diag[i] += bndTrans[-k - 1];
+        }
+        gershgorin = max(gershgorin, (diag[i] + offSum) / diag[i]);
+    }
+}
+
+void Problem::solveMatrixFree(vector<double> &sol)
+{
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    vector<double> rhs, diag;
+    assembleRhs(rhs);
+    double lmax;
+    operatorDiagonal(diag, lmax);
+    stats.tAssemble = seconds_since(t0);
+
+    auto A = [this](const double *x, double *y){ applyOperator(x, y); };
+    if(initialGuess.empty())
+        sol.assign(matrix.n, 0.0);
+    else
+        sol = initialGuess;
+    const double rtol = 1e-10, atol = absoluteTolerance(rhs);
+    const unsigned maxIter = 100000;
+    KrylovStats kstats;
+    {
+        PROFILE_SCOPE("Solve");
+        if(solverType == SOLVER_MF_CHEBYSHEV){
+            // Degree-4 polynomial on [lmax/30, lmax]
+            ChebyshevPrec<decltype(A)> M(A, diag, lmax / 30, lmax, 4);
+            kstats = pcg(A, M, rhs, sol, rtol, atol, maxIter);
+        }
+        else{
+            JacobiPrec M(diag);
+            kstats = pcg(A, M, rhs, sol, rtol, atol, maxIter);
+        }
+    }
+    stats.iterations = kstats.iterations;
+    printf("Number of iterations: %u\n", kstats.iterations);
+    printf("Residual:             %e\n", kstats.residual);
+    if(!kstats.converged){
+        printf("Linear solver failed: no convergence\n");
+        exit(1);
+    }
+}
+
+// Solves stop at max(1e-10 |r0|, atol). From the zero guess r0 = b; with an
+// initial guess atol = 1e-10 |b| keeps the target of the zero-guess solve,
+// so that iteration counts of cold and warm starts compare.
+double Problem::absoluteTolerance(const vector<double> &b) const
+{
+    if(initialGuess.empty())
+        return 1e-14;
+    return max(1e-14, 1e-10 * sqrt(krylov_dot(b, b)));
+}
+
+// Stores sol in the solution tag and compares it with the analytical solution
+void Problem::computeErrors(const vector<double> &sol)
+{
+    PROFILE_SCOPE("error norms");
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
     double normC = 0.0, normL2 = 0.0;
     for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
         Cell c = icell->getAsCell();
@@ -273,26 +593,505 @@ void Problem::run()
         normL2 += diff * c.Volume();
         normC = max(normC, diff);
     }
+    stats.tNorms = seconds_since(t0);
     printf("\nError C-norm:  %e\n", normC);
     printf("Error L2-norm: %e\n", normL2);
+    stats.normC = normC;
+    stats.normL2 = normL2;
+}
+
+void Problem::run()
+{
+    // Matrix size
+    unsigned N = matrix.n;
+    // Right-hand side vector
+    vector<double> rhs;
+    std::cout << "N = " << N << "\n";
 
-    m.Save("res.pvtk");
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now(), t0 = tStart;
+    vector<double> sol;
+    double operatorMB;
+    if(solverType == SOLVER_MF_JACOBI || solverType == SOLVER_MF_CHEBYSHEV){
+        solveMatrixFree(sol);
+        stats.tSolve = seconds_since(t0) - stats.tAssemble;
+        // Face arrays and cell-to-face lists read by applyOperator
+        operatorMB = (16.0 * intTrans.size() + 20.0 * bndTrans.size() + 4.0 * (N + 1) + 4.0 * cellFaces.size()) / 1048576;
+    }
+    else{
+        if(parallelAssembly)
+            assembleCellCentric(rhs);
+        else
+            assembleGlobalSystem(rhs);
+        stats.tAssemble = seconds_since(t0);
+
+        t0 = chrono::steady_clock::now();
+        if(solverType == SOLVER_AMG)
+            solveAMG(rhs, sol);
+        else
+            solveInmost(rhs, sol);
+        stats.tSolve = seconds_since(t0);
+        // CSR matrix plus the copy handed to the solver (index and value per entry)
+        operatorMB = (4.0 * (N + 1) + 12.0 * matrix.nnz() + 16.0 * matrix.nnz()) / 1048576;
+    }
+    stats.dofs = N;
+    stats.operatorMB = operatorMB;
+    printf("Time to solution: %.3f s, operator storage: %.2f MB, peak RSS: %.1f MB\n",
+           seconds_since(tStart), operatorMB, peak_rss_mb());
+    boundaryBalance(sol);
+    computeErrors(sol);
+    solution.swap(sol);
+
+    save("res");
 }
 
-int main(int argc, char ** argv)
+// Vertices of every cell in global index order: cell i has the points
+// (px[l], py[l]), l = start[i], ..., start[i+1]-1, in order around it
+void Problem::cellPolygons(vector<unsigned> &start, vector<double> &px, vector<double> &py) const
 {
-    if( argc < 2 )
-    {
-        printf("Usage: %s mesh_file\n", argv[0]);
-        return -1;
-    }
-    for (int i = 1; i < argc; i++) {
-        Mesh m;
-        m.Load(argv[i]);
-        Problem P(m);
-        P.initProblem();
-        P.run();
-        printf("Success\n\n");
-    }
-    return 0;
+    unsigned N = matrix.n;
+    start.assign(N + 1, 0);
+    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++)
+        start[icell->Integer(tagGlobInd) + 1] = static_cast<unsigned>(icell->getAsCell().getNodes().size());
+    for(unsigned i = 0; i < N; i++)
+        start[i + 1] += start[i];
+    px.resize(start[N]);
+    py.resize(start[N]);
+    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
+        ElementArray<Node> nodes = icell->getAsCell().getNodes();
+        unsigned l = start[icell->Integer(tagGlobInd)];
+        for(unsigned k = 0; k < nodes.size(); k++, l++){
+            px[l] = nodes[k].Coords()[0];
+            py[l] = nodes[k].Coords()[1];
+        }
+    }
 }
+
+// Barycenters of the cells in global index order
+void Problem::cellCenters(vector<double> &cx, vector<double> &cy) const
+{
+    cx.resize(matrix.n);
+    cy.resize(matrix.n);
+    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++){
+        double xc[2];
+        icell->getAsCell().Barycenter(xc);
+        unsigned i = static_cast<unsigned>(icell->Integer(tagGlobInd));
+        cx[i] = xc[0];
+        cy[i] = xc[1];
+    }
+}
+
+// Implicit time stepping for V du/dt = -K u + b, where K = -A is the TPFA
+// operator and b holds the Dirichlet and source terms. K and b are
+// assembled once. The step matrix S = c V/dt + theta K has the pattern of
+// K; it and its preconditioner are rebuilt only when c/dt or theta change.
+// Every solve starts from the previous state.
+void Problem::runTransient(const TransientParams &tp)
+{
+    if(tp.explicitScheme != STS_NONE){
+        runSuperTimeStepping(tp);
+        return;
+    }
+    unsigned N = matrix.n;
+    int n = static_cast<int>(N);
+    // Matrix-free steps use the Jacobi preconditioner of S
+    bool matrixFree = solverType == SOLVER_MF_JACOBI || solverType == SOLVER_MF_CHEBYSHEV;
+    const double rtol = 1e-10, atol = 1e-14;
+    std::cout << "N = " << N << "\n";
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    vector<double> b, diagK;
+    CSRMatrix K;
+    if(matrixFree){
+        assembleRhs(b);
+        double lmax;
+        operatorDiagonal(diagK, lmax);
+    }
+    else{
+        vector<double> rhs;
+        if(parallelAssembly)
+            assembleCellCentric(rhs);
+        else
+            assembleGlobalSystem(rhs);
+        K = matrix;
+        for(double &v : K.val)
+            v = -v;
+        b.resize(N);
+        for(unsigned i = 0; i < N; i++)
+            b[i] = -rhs[i];
+    }
+    stats.tAssemble = seconds_since(t0);
+    auto applyK = [&](const double *x, double *y){
+        if(matrixFree)
+            applyOperator(x, y);
+        else
+            csr_multiply(K, x, y);
+    };
+
+    // Step matrix, preconditioner and the coefficients they were built for
+    CSRMatrix S(K);
+    vector<double> diagS(N);
+    double shift = -1.0, theta = -1.0;
+    Sparse::Matrix SA;
+    Sparse::Vector rhsA, xA;
+    unique_ptr<Solver> inmost;
+    if(solverType == SOLVER_INMOST){
+        inmost.reset(new Solver("inner_mptiluc"));
+        inmost->SetParameter("drop_tolerance", "0");
+        inmost->SetParameter("absolute_tolerance", "1e-14");
+        inmost->SetParameter("relative_tolerance", "1e-10");
+        rhsA.SetInterval(0, N);
+        xA.SetInterval(0, N);
+    }
+
+    vector<double> u(N, 0.0), uPrev(N, 0.0), x(N), r(N), Ku(N);
+    unsigned rebuilds = 0, totalIterations = 0, bdf2Steps = 0;
+    double time = 0.0, dt = tp.dt, dtPrev = 0.0, tBuild = 0.0, tSolve = 0.0, change = 0.0;
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    for(unsigned step = 1; step <= tp.steps; step++){
+        // Variable-step BDF2 with omega = dt / dtPrev:
+        //   V/dt ((1+2w)/(1+w) u^{n+1} - (1+w) u^n + w^2/(1+w) u^{n-1}) = -K u^{n+1} + b,
+        // the usual 3/2, 2, 1/2 for a constant dt. The first step is backward Euler.
+        TimeScheme scheme = tp.scheme;
+        if(scheme == TIME_BDF2 && step == 1)
+            scheme = TIME_BE;
+        double omega = scheme == TIME_BDF2 ? dt / dtPrev : 0.0;
+        double wNow = 1.0 + omega, wPrev = omega * omega / (1.0 + omega);
+        double c = scheme == TIME_BDF2 ? (1.0 + 2.0 * omega) / (1.0 + omega) : 1.0;
+        if(scheme == TIME_BDF2)
+            bdf2Steps++;
+        double th = scheme == TIME_CN ? 0.5 : 1.0;
+        if(c / dt != shift || th != theta){
+            PROFILE_SCOPE("form step matrix");
+            t0 = chrono::steady_clock::now();
+            shift = c / dt;
+            theta = th;
+            if(matrixFree){
+                for(unsigned i = 0; i < N; i++)
+                    diagS[i] = shift * cellVolume[i] + theta * diagK[i];
+            }
+            else{
+                for(unsigned l = 0; l < S.nnz(); l++)
+                    S.val[l] = theta * K.val[l];
+                for(unsigned i = 0; i < N; i++)
+                    S.val[diagSlot[i]] += shift * cellVolume[i];
+                if(solverType == SOLVER_AMG)
+                    amg_setup(S, AMGParams(), amg, rebuilds == 0);
+                else{
+                    csr_to_sparse(S, SA);
+                    inmost->SetMatrix(SA);
+                }
+            }
+            tBuild += seconds_since(t0);
+            rebuilds++;
+        }
+
+        t0 = chrono::steady_clock::now();
+        if(scheme == TIME_CN)
+            applyK(u.data(), Ku.data());
+#pragma omp parallel for schedule(static)
+        for(int i = 0; i < n; i++){
+            double Vdt = cellVolume[i] / dt;
+            if(scheme == TIME_BDF2)
+                r[i] = Vdt * (wNow * u[i] - wPrev * uPrev[i]) + b[i];
+            else if(scheme == TIME_CN)
+                r[i] = Vdt * u[i] - 0.5 * Ku[i] + b[i];
+            else
+                r[i] = Vdt * u[i] + b[i];
+        }
+
+        // Warm start from the previous state
+        x = u;
+        unsigned iterations;
+        bool converged;
+        {
+            PROFILE_SCOPE("Solve");
+            if(solverType == SOLVER_INMOST){
+                for(unsigned i = 0; i < N; i++){
+                    rhsA[i] = r[i];
+                    xA[i] = x[i];
+                }
+                converged = inmost->Solve(rhsA, xA);
+                iterations = static_cast<unsigned>(inmost->Iterations());
+                for(unsigned i = 0; i < N; i++)
+                    x[i] = xA[i];
+            }
+            else{
+                KrylovStats kstats;
+                if(matrixFree){
+                    auto Sop = [&](const double *v, double *y){
+                        applyOperator(v, y);
+#pragma omp parallel for schedule(static)
+                        for(int i = 0; i < n; i++)
+                            y[i] = theta * y[i] + shift * cellVolume[i] * v[i];
+                    };
+                    kstats = pcg(Sop, JacobiPrec(diagS), r, x, rtol, atol, 100000);
+                }
+                else if(solverType == SOLVER_AMG)
+                    kstats = pcg(CSROperator{&S}, amg, r, x, rtol, atol, 1000);
+                converged = kstats.converged;
+                iterations = kstats.iterations;
+            }
+        }
+        if(!converged){
+            printf("Linear solver failed at step %u\n", step);
+            exit(1);
+        }
+        tSolve += seconds_since(t0);
+        totalIterations += iterations;
+
+        change = 0.0;
+        for(unsigned i = 0; i < N; i++)
+            change = max(change, fabs(x[i] - u[i]));
+        uPrev.swap(u);
+        u.swap(x);
+        time += dt;
+        dtPrev = dt;
+
+        if(tp.outputEvery > 0 && (step % tp.outputEvery == 0 || step == tp.steps)){
+            printf("Step %u: t = %g, dt = %g, iterations %u, max change %e\n", step, time, dt, iterations, change);
+            saveStep(u, step);
+        }
+        dt = min(dt * tp.dtGrowth, tp.dtMax);
+    }
+    double tTotal = seconds_since(tStart);
+    unsigned steps = max(tp.steps, 1u);
+    stats.dofs = N;
+    stats.iterations = totalIterations;
+    stats.tSolve = tTotal;
+
+    printf("Time stepping: %u steps to t = %g, %u step matrix builds (%.3f s)\n", tp.steps, time, rebuilds, tBuild);
+    if(tp.scheme == TIME_BDF2)
+        printf("BDF2 steps: %u of %u, the first one is backward Euler\n", bdf2Steps, tp.steps);
+    printf("Per step: %.2f iterations, solve %.3f ms, total %.3f ms\n",
+           static_cast<double>(totalIterations) / steps, 1e3 * tSolve / steps, 1e3 * tTotal / steps);
+    printf("Max change in the last step: %e\n", change);
+    // Against the steady analytical solution: small only once the run is near steady state
+    computeErrors(u);
+    solution = u;
+    if(tp.outputEvery == 0){
+        save("res");
+    }
+}
+
+// The writer is needed for OUTPUT_VTU only
+void Problem::setOutput(const OutputParams &output_, VTUWriter *writer)
+{
+    output = output_;
+    vtuWriter = writer;
+    if(output.format == OUTPUT_VTU && !vtuWriter)
+        output.format = OUTPUT_VTK;
+    if(output.format == OUTPUT_VTK)
+        output_select_tags(m, {tagNameConc, tagNameD, tagNameBCtype, tagNameBCval, tagNameSource,
+                               tagNameConcAn, tagNameGlobInd, tagNameBCcond}, output.fields);
+}
+
+// <base>.pvtk, or a snapshot of the output fields handed to the background
+// writer, so that the caller goes on while <base>.vtu is encoded and written;
+// nothing in OUTPUT_NONE
+void Problem::save(const string &base)
+{
+    if(output.format == OUTPUT_NONE)
+        return;
+    PROFILE_SCOPE("Save");
+    if(output.format == OUTPUT_VTK){
+        m.Save(base + ".pvtk");
+        return;
+    }
+    VTUData data;
+    if(!vtu_snapshot(m, output.fields.empty() ? vtuFields : output.fields, data))
+        printf("Some output fields are not node or cell tags, skipped\n");
+    vtuWriter->write(base + ".vtu", data);
+}
+
+// Writes sol to res_<step>.pvtk or .vtu
+void Problem::saveStep(const vector<double> &sol, unsigned step)
+{
+    if(output.format == OUTPUT_NONE)
+        return;
+    for(Mesh::iteratorCell icell = m.BeginCell(); icell != m.EndCell(); icell++)
+        icell->Real(tagConc) = sol[icell->Integer(tagGlobInd)];
+    char base[64];
+    snprintf(base, sizeof(base), "res_%05u", step);
+    save(base);
+}
+
+// Explicit Runge-Kutta-Legendre super-time-stepping of V du/dt = b - K u
+// with the matrix-free operator: no matrix and no linear solves. The
+// spectral radius of V^{-1} K is estimated once by power iteration with a
+// 10% margin, capped by the Gershgorin bound, and the number of stages is
+// chosen again whenever dt changes.
+void Problem::runSuperTimeStepping(const TransientParams &tp)
+{
+    unsigned N = matrix.n;
+    int n = static_cast<int>(N);
+    std::cout << "N = " << N << "\n";
+
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    vector<double> b, diagK;
+    double gershgorin, bound = 0.0;
+    assembleRhs(b);
+    operatorDiagonal(diagK, gershgorin);
+    // Row sums of |K| are at most gershgorin * k_ii
+    for(unsigned i = 0; i < N; i++)
+        bound = max(bound, gershgorin * diagK[i] / cellVolume[i]);
+    auto J = [&](const double *x, double *y){
+        applyOperator(x, y);
+#pragma omp parallel for simd schedule(static)
+        for(int i = 0; i < n; i++)
+            y[i] /= cellVolume[i];
+    };
+    double rho = min(1.1 * sts_spectral_radius(J, N), bound);
+    stats.tAssemble = seconds_since(t0);
+    printf("Spectral radius of V^-1 K: %e (Gershgorin bound %e), forward Euler dt <= %e\n", rho, bound, 2.0 / rho);
+
+    // F(y) = V^{-1} (b - K y)
+    auto F = [&](const double *y, double *f){
+        applyOperator(y, f);
+#pragma omp parallel for simd schedule(static)
+        for(int i = 0; i < n; i++)
+            f[i] = (b[i] - f[i]) / cellVolume[i];
+    };
+    SuperTimeStepper sts;
+    sts.scheme = tp.explicitScheme;
+
+    vector<double> u(N, 0.0), uOld(N);
+    unsigned stages = 0, totalStages = 0;
+    double time = 0.0, dt = tp.dt, dtStages = -1.0, change = 0.0;
+    chrono::steady_clock::time_point tStart = chrono::steady_clock::now();
+    for(unsigned step = 1; step <= tp.steps; step++){
+        if(dt != dtStages){
+            dtStages = dt;
+            stages = sts.stagesFor(dt, rho);
+        }
+        uOld = u;
+        {
+            PROFILE_SCOPE("Super step");
+            sts.step(F, dt, stages, u);
+        }
+        totalStages += stages;
+        change = 0.0;
+        for(unsigned i = 0; i < N; i++)
+            change = max(change, fabs(u[i] - uOld[i]));
+        time += dt;
+
+        if(tp.outputEvery > 0 && (step % tp.outputEvery == 0 || step == tp.steps)){
+            printf("Step %u: t = %g, dt = %g, stages %u, max change %e\n", step, time, dt, stages, change);
+            saveStep(u, step);
+        }
+        dt = min(dt * tp.dtGrowth, tp.dtMax);
+    }
+    double tTotal = seconds_since(tStart);
+    unsigned steps = max(tp.steps, 1u);
+    stats.dofs = N;
+    stats.iterations = totalStages;
+    stats.tSolve = tTotal;
+
+    printf("Super-time-stepping: %u steps to t = %g, %u operator applications (forward Euler would need %.0f)\n",
+           tp.steps, time, totalStages, ceil(0.5 * rho * time));
+    printf("Per step: %.2f stages, %.3f ms\n", static_cast<double>(totalStages) / steps, 1e3 * tTotal / steps);
+    printf("Max change in the last step: %e\n", change);
+    computeErrors(u);
+    solution = u;
+    if(tp.outputEvery == 0){
+        save("res");
+    }
+}
+
+void Problem::buildLocator()
+{
+    PROFILE_SCOPE("build point locator");
+    vector<unsigned> start;
+    vector<double> px, py;
+    cellPolygons(start, px, py);
+    locator.build(start, px, py);
+    cellCenters(cellCx, cellCy);
+}
+
+// Unlimited least-squares gradients of the solution of the last run: g_i
+// solves sum e e^T g = sum e (u_j - u_i), e = x_j - x_i, over the face
+// neighbours j of cell i; zero where they span fewer than two directions
+void Problem::solutionGradients(vector<double> &gx, vector<double> &gy)
+{
+    unsigned N = matrix.n;
+    if(cellCx.size() != N)
+        cellCenters(cellCx, cellCy);
+    vector<double> axx(N, 0.0), axy(N, 0.0), ayy(N, 0.0), rx(N, 0.0), ry(N, 0.0);
+    for(size_t k = 0; k < intTrans.size(); k++){
+        unsigned a = intCellA[k], b = intCellB[k];
+        double ex = cellCx[b] - cellCx[a], ey = cellCy[b] - cellCy[a], du = solution[b] - solution[a];
+        for(unsigned i : {a, b}){
+            axx[i] += ex * ex;
+            axy[i] += ex * ey;
+            ayy[i] += ey * ey;
+            rx[i] += ex * du;
+            ry[i] += ey * du;
+        }
+    }
+    gx.assign(N, 0.0);
+    gy.assign(N, 0.0);
+    for(unsigned i = 0; i < N; i++){
+        double det = axx[i] * ayy[i] - axy[i] * axy[i];
+        if(det <= 1e-12 * (axx[i] + ayy[i]) * (axx[i] + ayy[i]))
+            continue;
+        gx[i] = (ayy[i] * rx[i] - axy[i] * ry[i]) / det;
+        gy[i] = (axx[i] * ry[i] - axy[i] * rx[i]) / det;
+    }
+}
+
+// Solution of the last run at the points (px[i], py[i]), NaN outside the
+// mesh: the value of the containing cell, or with 'reconstruct' the linear
+// reconstruction u_i + g_i (x - x_i), where g_i is the (unlimited)
+// least-squares gradient from the face neighbours of cell i.
+// Points are located and evaluated in parallel.
+void Problem::evaluate(const vector<double> &px, const vector<double> &py, vector<double> &values, bool reconstruct)
+{
+    unsigned N = matrix.n;
+    if(locator.numPolygons() != N)
+        buildLocator();
+    vector<double> gx, gy;
+    if(reconstruct)
+        solutionGradients(gx, gy);
+    int n = static_cast<int>(px.size());
+    vector<int> cells(n);
+    locator.locate(px.data(), py.data(), static_cast<unsigned>(n), cells.data());
+    values.resize(n);
+#pragma omp parallel for schedule(static)
+    for(int i = 0; i < n; i++){
+        int c = cells[i];
+        if(c < 0)
+            values[i] = NAN;
+        else if(reconstruct)
+            values[i] = solution[c] + gx[c] * (px[i] - cellCx[c]) + gy[c] * (py[i] - cellCy[c]);
+        else
+            values[i] = solution[c];
+    }
+}
+
+// Throughput of evaluate() at pseudo-random points of the mesh bounding box,
+// and the largest difference from the analytical solution there
+void Problem::benchmarkProbes(unsigned numProbes)
+{
+    chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+    buildLocator();
+    double tBuild = seconds_since(t0);
+    vector<double> px, py, values;
+    random_probe_points(locator, numProbes, px, py);
+    printf("Probes: %u points, locator built in %.3f s\n", numProbes, tBuild);
+    for(bool reconstruct : {false, true}){
+        t0 = chrono::steady_clock::now();
+        evaluate(px, py, values, reconstruct);
+        double tEval = seconds_since(t0);
+        double err = 0.0;
+        unsigned outside = 0;
+        for(unsigned i = 0; i < numProbes; i++){
+            if(values[i] != values[i])
+                outside++;
+            else
+                err = max(err, fabs(values[i] - C(px[i], py[i])));
+        }
+        printf("  %-14s %8.2f M probes/s, %u outside, max |u - u_h| = %e\n",
+               reconstruct ? "reconstructed:" : "cell values:", 1e-6 * numProbes / max(tEval, 1e-12), outside, err);
+    }
+}
+
+} // namespace fvm
@@ -0,0 +1,251 @@
+#ifndef DIFFUSION_FVM_H
+#define DIFFUSION_FVM_H
+
+#include "inmost.h"
+#include "reorder.h"
+#include "amg.h"
+#include "sts.h"
+#include "point_locator.h"
+#include "output.h"
+#include <math.h>
+#include <string.h>
+#include <chrono>
+#include <string>
+#include <vector>
+
+// TPFA finite volume solver of the stationary and transient diffusion
+// problem. Implemented in diffusion_fvm.cpp, which is built as the
+// fvm_problem library and linked by diffusion_fvm and convergence_study.
+
+namespace fvm
+{
+
+using namespace INMOST;
+using namespace std;
+
+const double dx = 1.0;
+const double dy = 1.0;
+const double dxy = 0.0;
+const double a = 10;
+
+inline double C(double x, double y) // analytical solution
+{
+    return sin(a*x) * sin(a*y);
+}
+
+inline double source(double x, double y)
+{
+    return -a*a * (2.*dxy * cos(a*x)*cos(a*y) - (dx+dy) * sin(a*x)*sin(a*y));
+}
+
+enum BoundCondType
+{
+    BC_DIR = 1,
+    BC_NEUM = 2
+};
+
+/// Summary of the last run(), used by the convergence study driver
+struct RunStats
+{
+    /// Number of unknowns
+    unsigned dofs;
+    /// Linear solver iterations
+    unsigned iterations;
+    /// Wall time of the assembly and of the solve (setup + iterations), seconds
+    double tAssemble, tSolve;
+    /// Errors against the analytical solution in cell centers
+    double normC, normL2;
+    /// Wall time of computeErrors(), seconds
+    double tNorms;
+    /// Storage of the operator: matrices or the face arrays of the matrix-free one, MB
+    double operatorMB;
+};
+
+/// How the linear system is solved
+enum SolverType
+{
+    /// INMOST inner_mptiluc
+    SOLVER_INMOST = 1,
+    /// CG with the smoothed aggregation AMG preconditioner
+    SOLVER_AMG = 2,
+    /// Matrix-free operator, CG with Jacobi preconditioner
+    SOLVER_MF_JACOBI = 3,
+    /// Matrix-free operator, CG with Chebyshev polynomial preconditioner
+    SOLVER_MF_CHEBYSHEV = 4
+};
+
+inline bool parse_solver(const char *name, SolverType &type)
+{
+    if(!strcmp(name, "inmost"))
+        type = SOLVER_INMOST;
+    else if(!strcmp(name, "amg"))
+        type = SOLVER_AMG;
+    else if(!strcmp(name, "mf-jacobi"))
+        type = SOLVER_MF_JACOBI;
+    else if(!strcmp(name, "mf-chebyshev"))
+        type = SOLVER_MF_CHEBYSHEV;
+    else
+        return false;
+    return true;
+}
+
+/// Time discretization of V du/dt = -K u + b
+enum TimeScheme
+{
+    /// Backward Euler
+    TIME_BE = 1,
+    /// Second order backward differences with variable steps (ratio dt / dtPrev
+    /// below 1 + sqrt(2) for stability), started with one backward Euler step
+    TIME_BDF2 = 2,
+    /// Crank-Nicolson
+    TIME_CN = 3
+};
+
+/// Settings of runTransient()
+struct TransientParams
+{
+    TimeScheme scheme = TIME_BE;
+    /// Initial time step and number of steps
+    double dt = 1e-3;
+    unsigned steps = 0;
+    /// The solution is saved every outputEvery steps and after the last one, 0 = only after the last one
+    unsigned outputEvery = 0;
+    /// dt is multiplied by dtGrowth after every step, up to dtMax
+    double dtGrowth = 1.0, dtMax = 1e300;
+    /// Explicit super-time-stepping instead of the implicit scheme
+    STSScheme explicitScheme = STS_NONE;
+};
+
+/// Wall time in seconds since t0
+inline double seconds_since(chrono::steady_clock::time_point t0)
+{
+    return chrono::duration<double>(chrono::steady_clock::now() - t0).count();
+}
+
+// Class including everything needed
+class Problem
+{
+private:
+    /// Mesh
+    Mesh &m;
+    // =========== Tags =============
+    /// Solution tag: 1 real value per cell
+    Tag tagConc;
+    /// Diffusion tensor tag: 3 real values (Dx, Dy, Dxy) per cell
+    Tag tagD;
+    /// Boundary condition type tag: 1 integer value per face, sparse on faces
+    Tag tagBCtype;
+    /// Boundary condition value tag: 1 real value per face, sparse on faces
+    Tag tagBCval;
+    /// Right-hand side tag: 1 real value per cell
+    Tag tagSource;
+    /// Analytical solution tag: 1 real value per cell
+    Tag tagConcAn;
+    /// Global index tag: 1 integer value per cell
+    Tag tagGlobInd;
+    /// Boundary conductivity: 1 real value per face, sparse on faces
+    Tag tagBCcond;
+
+    // =========== Tag names ===========
+    const string tagNameConc = "Concentration";
+    const string tagNameD = "Diffusion_tensor";
+    const string tagNameBCtype = "BC_type";
+    const string tagNameBCval = "BC_value";
+    const string tagNameSource = "Source";
+    const string tagNameConcAn = "Concentration_analytical";
+    const string tagNameGlobInd = "Global_Index";
+    const string tagNameBCcond = "BC_conductivity";
+
+    /// Numbering of cells
+    Ordering ordering;
+    /// Linear solver used by run()
+    SolverType solverType;
+    /// AMG hierarchy, built once per matrix and reused for every right-hand side
+    Multigrid amg;
+    /// Assemble with the thread-parallel cell loop instead of the face loop
+    bool parallelAssembly;
+
+    // =========== Face cache
+    // Structure-of-arrays copy of everything the assembly needs, built once
+    // at the end of initProblem(). Cells are referred to by global index.
+    /// Interior faces: back and front cell, transmissibility times area
+    vector<unsigned> intCellA, intCellB;
+    vector<double> intTrans;
+    /// Boundary faces: cell, transmissibility times area, BC type and value
+    vector<unsigned> bndCell;
+    vector<double> bndTrans;
+    vector<int> bndType;
+    vector<double> bndValue;
+    /// Volume and source times volume of every cell
+    vector<double> cellVolume, cellLoad;
+    /// Faces of cell i: cellFaces[cellFaceStart[i]], ..., interior ones first;
+    /// k >= 0 is interior face k, k < 0 is boundary face -k-1
+    vector<unsigned> cellFaceStart;
+    vector<int> cellFaces;
+
+    // =========== Matrix
+    /// TPFA matrix; its pattern is built on the first assembly
+    CSRMatrix matrix;
+    /// Slots of (A,A), (A,B), (B,A), (B,B) of interior face k: intSlot[4*k + ...]
+    vector<unsigned> intSlot;
+    /// Slot of the diagonal entry of every row
+    vector<unsigned> diagSlot;
+
+    /// Initial guess of the next run(), empty for zero, and the solution of the last one
+    vector<double> initialGuess, solution;
+
+    /// Cells for evaluate() and their barycenters, built on its first call
+    PointLocator locator;
+    vector<double> cellCx, cellCy;
+    void buildLocator();
+
+    RunStats stats;
+
+    void renumberCells();
+    void buildFaceCache();
+    void buildMatrixPattern();
+    void solveInmost(const vector<double> &rhs, vector<double> &sol);
+    void solveAMG(const vector<double> &rhs, vector<double> &sol);
+    void solveMatrixFree(vector<double> &sol);
+    void boundaryBalance(const vector<double> &sol) const;
+    void computeErrors(const vector<double> &sol);
+    double absoluteTolerance(const vector<double> &b) const;
+    /// Output format and fields, and the writer of VTU output
+    OutputParams output;
+    VTUWriter *vtuWriter = nullptr;
+    /// Tags written to .vtu files unless output.fields is set; the BC tags
+    /// live on faces and are left out
+    vector<string> vtuFields = {tagNameConc, tagNameConcAn, tagNameSource, tagNameD, tagNameGlobInd};
+    void save(const string &base);
+    void saveStep(const vector<double> &sol, unsigned step);
+    void runSuperTimeStepping(const TransientParams &tp);
+
+public:
+    Problem(Mesh &m_);
+    ~Problem();
+    void initProblem();
+    void assembleGlobalSystem(vector<double> &rhs);
+    void assembleCellCentric(vector<double> &rhs);
+    void checkAssembly();
+    void runTransient(const TransientParams &tp);
+    void assembleRhs(vector<double> &rhs) const;
+    void applyOperator(const double *x, double *y) const;
+    void operatorDiagonal(vector<double> &diag, double &gershgorin) const;
+    void run();
+    void setOrdering(Ordering ordering_) { ordering = ordering_; }
+    void setSolver(SolverType type) { solverType = type; }
+    void setParallelAssembly(bool parallel) { parallelAssembly = parallel; }
+    void setInitialGuess(const vector<double> &guess) { initialGuess = guess; }
+    void setOutput(const OutputParams &output_, VTUWriter *writer);
+    const vector<double> &getSolution() const { return solution; }
+    void cellPolygons(vector<unsigned> &start, vector<double> &px, vector<double> &py) const;
+    void cellCenters(vector<double> &cx, vector<double> &cy) const;
+    void solutionGradients(vector<double> &gx, vector<double> &gy);
+    void evaluate(const vector<double> &px, const vector<double> &py, vector<double> &values, bool reconstruct = false);
+    void benchmarkProbes(unsigned numProbes);
+    const RunStats &getStats() const { return stats; }
+};
+
+} // namespace fvm
+
+#endif
@@ -0,0 +1,272 @@
+#include "diffusion_fvm.h"
+#include "mesh_load.h"
+#include "profiler.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+using namespace INMOST;
+using namespace std;
+
+int main(int argc, char ** argv)
+{
+    using namespace fvm;
+
+    string reportFile, traceFile;
+    Ordering ordering = ORDER_NATIVE;
+    SolverType solverType = SOLVER_INMOST;
+    bool parallelAssembly = false, checkAssembly = false, nested = false, nestedCompare = false;
+    unsigned numProbes = 0;
+    MeshLoadOptions meshOptions;
+    TransientParams transient;
+    vector<const char *> meshes;
+    // Output of a mesh is written while the next one is solved
+    OutputParams output;
+    VTUWriter writer;
+    for (int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "--profile") && i + 1 < argc)
+            reportFile = argv[++i];
+        else if(!strcmp(argv[i], "--ordering") && i + 1 < argc){
+            if(!parse_ordering(argv[++i], ordering)){
+                printf("Unknown ordering %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "--assembly") && i + 1 < argc){
+            i++;
+            if(!strcmp(argv[i], "serial"))
+                parallelAssembly = false;
+            else if(!strcmp(argv[i], "parallel"))
+                parallelAssembly = true;
+            else if(!strcmp(argv[i], "check"))
+                checkAssembly = true;
+            else{
+                printf("Unknown assembly %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "--threads") && i + 1 < argc){
+            int numThreads = atoi(argv[++i]);
+#ifdef _OPENMP
+            omp_set_num_threads(numThreads);
+#else
+            if(numThreads > 1)
+                printf("Built without OpenMP, --threads %d ignored\n", numThreads);
+#endif
+        }
+        else if(!strcmp(argv[i], "--solver") && i + 1 < argc){
+            i++;
+            if(!parse_solver(argv[i], solverType)){
+                printf("Unknown solver %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "--time-scheme") && i + 1 < argc){
+            i++;
+            if(!strcmp(argv[i], "be"))
+                transient.scheme = TIME_BE;
+            else if(!strcmp(argv[i], "bdf2"))
+                transient.scheme = TIME_BDF2;
+            else if(!strcmp(argv[i], "cn"))
+                transient.scheme = TIME_CN;
+            else{
+                printf("Unknown time scheme %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "--explicit") && i + 1 < argc){
+            i++;
+            if(!strcmp(argv[i], "rkl1"))
+                transient.explicitScheme = STS_RKL1;
+            else if(!strcmp(argv[i], "rkl2"))
+                transient.explicitScheme = STS_RKL2;
+            else{
+                printf("Unknown explicit scheme %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "--dt") && i + 1 < argc)
+            transient.dt = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--steps") && i + 1 < argc)
+            transient.steps = static_cast<unsigned>(atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--output-every") && i + 1 < argc)
+            transient.outputEvery = static_cast<unsigned>(atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--dt-growth") && i + 1 < argc)
+            transient.dtGrowth = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--dt-max") && i + 1 < argc)
+            transient.dtMax = atof(argv[++i]);
+        else if(!strcmp(argv[i], "--nested"))
+            nested = true;
+        else if(!strcmp(argv[i], "--nested-compare"))
+            nested = nestedCompare = true;
+        else if(!strcmp(argv[i], "--probe") && i + 1 < argc)
+            numProbes = static_cast<unsigned>(atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--refine") && i + 1 < argc)
+            meshOptions.refine = static_cast<unsigned>(atoi(argv[++i]));
+        else if(!strcmp(argv[i], "--fast-vtk"))
+            meshOptions.fastVtk = true;
+        else if(!strcmp(argv[i], "--mesh-cache") && i + 1 < argc)
+            meshOptions.cacheDir = argv[++i];
+        else if(!strcmp(argv[i], "--format") && i + 1 < argc){
+            i++;
+            if(!parse_output_format(argv[i], output.format)){
+                printf("Unknown output format %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "--encoding") && i + 1 < argc){
+            i++;
+            if(!strcmp(argv[i], "raw"))
+                writer.encoding = VTU_RAW;
+            else if(!strcmp(argv[i], "base64"))
+                writer.encoding = VTU_BASE64;
+            else{
+                printf("Unknown encoding %s\n", argv[i]);
+                return -1;
+            }
+        }
+        else if(!strcmp(argv[i], "--compress")){
+            writer.compress = vtu_compression_available();
+            if(!writer.compress)
+                printf("Built without zlib, --compress ignored\n");
+        }
+        else if(!strcmp(argv[i], "--fields") && i + 1 < argc)
+            output.fields = vtu_field_list(argv[++i]);
+        else if(!strcmp(argv[i], "--trace") && i + 1 < argc){
+            traceFile = argv[++i];
+            profiler().enableTrace();
+        }
+        else
+            meshes.push_back(argv[i]);
+    }
+    if( meshes.empty() )
+    {
+        printf("Usage: %s mesh_1 ... mesh_n [--refine k] [--fast-vtk] [--mesh-cache dir]\n"
+               "       [--profile report.json] [--trace trace.json]\n"
+               "       [--ordering native|rcm|hilbert|morton] [--solver inmost|amg|mf-jacobi|mf-chebyshev]\n"
+               "       [--assembly serial|parallel|check] [--threads N] [--nested|--nested-compare] [--probe N]\n"
+               "       [--steps n --dt dt [--time-scheme be|bdf2|cn] [--explicit rkl1|rkl2] [--output-every k]\n"
+               "        [--dt-growth g] [--dt-max dt]]\n"
+               "       [--format vtk|vtu|none] [--fields name,name,...] [--encoding raw|base64] [--compress]\n"
+               "       mesh_i is a mesh file or tri:N / quad:N, the structured N x N mesh of the unit square\n", argv[0]);
+        return -1;
+    }
+    // Variable-step BDF2 is zero-stable for step ratios below 1 + sqrt(2)
+    if(transient.scheme == TIME_BDF2 && transient.dtGrowth >= 1.0 + sqrt(2.0)){
+        printf("--dt-growth %g is too large for BDF2, use at most 2.4\n", transient.dtGrowth);
+        return -1;
+    }
+    if(nested && (transient.steps > 0 || checkAssembly)){
+        printf("--nested only applies to steady solves\n");
+        nested = nestedCompare = false;
+    }
+    // Nested iteration: meshes are given from coarse to fine, every solve
+    // after the first starts from the previous solution, reconstructed
+    // linearly (cell value plus least-squares gradient) at the cell
+    // barycenters found by a point locator on the previous cells. With
+    // --nested-compare these meshes are first also solved from zero,
+    // without output, and the two solves are tabulated at the end.
+    PointLocator coarseCells;
+    vector<double> coarseSol, coarseCx, coarseCy, coarseGx, coarseGy;
+    OutputParams noOutput;
+    noOutput.format = OUTPUT_NONE;
+    string summary;
+    for (const char *meshFile : meshes) {
+        profiler().beginRun(meshFile);
+        Mesh m;
+        {
+            PROFILE_SCOPE("Mesh::Load");
+            if(!load_mesh(m, meshFile, meshOptions)){
+                printf("Bad mesh %s\n", meshFile);
+                return -1;
+            }
+        }
+        printf("Mesh %s: %d cells, %d nodes\n", meshFile, m.NumberOfCells(), m.NumberOfNodes());
+        Problem P(m);
+        P.setOrdering(ordering);
+        P.setSolver(solverType);
+        P.setParallelAssembly(parallelAssembly);
+        P.setOutput(output, &writer);
+        P.initProblem();
+        if(checkAssembly){
+            P.checkAssembly();
+            continue;
+        }
+        bool warm = nested && coarseCells.numPolygons() > 0;
+        RunStats cold;
+        if(warm && nestedCompare){
+            printf("Cold start, for comparison:\n");
+            P.setOutput(noOutput, NULL);
+            P.run();
+            P.setOutput(output, &writer);
+            cold = P.getStats();
+        }
+        double tInterp = 0.0;
+        if(warm){
+            chrono::steady_clock::time_point t0 = chrono::steady_clock::now();
+            vector<double> cx, cy, guess;
+            P.cellCenters(cx, cy);
+            vector<int> cells(cx.size());
+            coarseCells.locate(cx.data(), cy.data(), static_cast<unsigned>(cx.size()), cells.data());
+            guess.resize(cx.size());
+            unsigned missed = 0;
+            for(size_t i = 0; i < cx.size(); i++){
+                int c = cells[i];
+                if(c < 0){
+                    guess[i] = 0.0;
+                    missed++;
+                }
+                else
+                    guess[i] = coarseSol[c] + coarseGx[c] * (cx[i] - coarseCx[c]) + coarseGy[c] * (cy[i] - coarseCy[c]);
+            }
+            tInterp = seconds_since(t0);
+            if(missed > 0)
+                printf("%u cells outside the previous mesh start from zero\n", missed);
+            printf("Warm start from the previous mesh (%.3f s):\n", tInterp);
+            P.setInitialGuess(guess);
+        }
+        if(transient.steps > 0)
+            P.runTransient(transient);
+        else
+            P.run();
+        if(numProbes > 0)
+            P.benchmarkProbes(numProbes);
+        if(warm && nestedCompare){
+            RunStats warmStats = P.getStats();
+            char line[256];
+            snprintf(line, sizeof(line), "%-32s %10u %8u %8u %10.3f %10.3f %10.3f %8.1f%%\n",
+                     meshFile, cold.dofs, cold.iterations, warmStats.iterations, cold.tSolve, warmStats.tSolve, tInterp,
+                     100.0 * (1.0 - (warmStats.tSolve + tInterp) / cold.tSolve));
+            summary += line;
+        }
+        if(nested){
+            vector<unsigned> start;
+            vector<double> px, py;
+            P.cellPolygons(start, px, py);
+            coarseCells.build(start, px, py);
+            coarseSol = P.getSolution();
+            P.cellCenters(coarseCx, coarseCy);
+            P.solutionGradients(coarseGx, coarseGy);
+        }
+        printf("Success\n\n");
+    }
+    if(!summary.empty()){
+        printf("Nested iteration, cold start vs warm start from the previous mesh:\n");
+        printf("%-32s %10s %8s %8s %10s %10s %10s %9s\n",
+               "mesh", "N", "it_cold", "it_warm", "t_cold", "t_warm", "t_interp", "saved");
+        printf("%s", summary.c_str());
+    }
+    if(output.format == OUTPUT_VTU){
+        writer.wait();
+        printf("Output: %u files, %.2f MB, written in %.3f s in the background, %.3f s waited for\n",
+               writer.files, writer.bytes / 1048576, writer.writeSeconds, writer.waitSeconds);
+    }
+    if(!reportFile.empty() && !profiler().writeReport(reportFile))
+        printf("Cannot write %s\n", reportFile.c_str());
+    if(!traceFile.empty() && !profiler().writeTrace(traceFile))
+        printf("Cannot write %s\n", traceFile.c_str());
+    return 0;
+}